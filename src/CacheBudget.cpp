@@ -0,0 +1,96 @@
+#include "CacheBudget.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX  // Keeps std::min and std::max usable.
+#include <windows.h>
+#endif
+
+void CacheBudget::configure(const nlohmann::json &config) {
+    if (!config.contains("cache") || !config["cache"].is_object())
+        return;
+    const nlohmann::json &cache = config["cache"];
+    std::lock_guard<std::mutex> lock(mutex);
+    // Read all, then assign, so a wrong-typed field throws before anything changes.
+    long long hostCap = cache.value("host_cap_mb", host_cap_bytes >> 20) << 20;
+    long long minBytes = cache.value("min_mb", min_bytes >> 20) << 20;
+    long long maxBytes = cache.value("max_mb", max_bytes >> 20) << 20;
+    double fileFactor = cache.value("file_factor", file_factor);
+    double memoryFraction = cache.value("memory_fraction", memory_fraction);
+    double backFraction = cache.value("back_fraction", back_fraction);
+    host_cap_bytes = hostCap;
+    min_bytes = minBytes;
+    max_bytes = maxBytes;
+    file_factor = fileFactor;
+    memory_fraction = memoryFraction;
+    back_fraction = backFraction;
+}
+
+long long CacheBudget::hostCapBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return host_cap_bytes;
+}
+
+CacheBudget::Allocation CacheBudget::acquire(const void *owner, long long fileSize) {
+    // Read /proc/meminfo before taking the lock.
+    long long memAvailable = availableMemory();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    long long want = fileSize < 0 ? max_bytes : static_cast<long long>(fileSize * file_factor);
+    want = std::min(std::max(want, min_bytes), max_bytes);
+    if (memAvailable > 0)
+        want = std::min(want, static_cast<long long>(memAvailable * memory_fraction));
+
+    reservations.erase(owner);
+    if (host_cap_bytes > 0) {
+        long long reserved = 0;
+        for (const auto &r : reservations)
+            reserved += r.second;
+        want = std::min(want, host_cap_bytes - reserved);
+    }
+    // Never go below the floor, even when the host is over-committed.
+    want = std::max(want, min_bytes);
+    reservations[owner] = want;
+
+    long long back = static_cast<long long>(want * back_fraction);
+    return {want - back, back};
+}
+
+void CacheBudget::release(const void *owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reservations.erase(owner);
+}
+
+long long CacheBudget::reservedBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    long long reserved = 0;
+    for (const auto &r : reservations)
+        reserved += r.second;
+    return reserved;
+}
+
+long long CacheBudget::availableMemory() {
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return static_cast<long long>(status.ullAvailPhys);
+    return -1;
+#else
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.rfind("MemAvailable:", 0) == 0) {
+            std::istringstream fields(line.substr(13));
+            long long kb = 0;
+            fields >> kb;
+            return kb * 1024;
+        }
+    }
+    return -1;
+#endif
+}
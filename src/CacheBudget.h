@@ -0,0 +1,45 @@
+#ifndef CACHEBUDGET_H
+#define CACHEBUDGET_H
+
+#include <mutex>
+#include <unordered_map>
+#include "json.hpp"
+
+// Sizes the mpv demuxer cache per load from the file size, the memory
+// available on the host and a per-host cap shared by every player in the process.
+class CacheBudget {
+public:
+    struct Allocation {
+        long long forwardBytes;  // demuxer-max-bytes
+        long long backBytes;     // demuxer-max-back-bytes
+    };
+
+    // Settings; written by configure() and read by acquire() under the mutex,
+    // so a reload can change them while players load files.
+    long long host_cap_bytes = 0;          // Total for all players on the host, 0 = no cap.
+    long long min_bytes = 16LL << 20;      // Floor for a single load.
+    long long max_bytes = 1024LL << 20;    // Ceiling for a single load.
+    double file_factor = 1.1;              // Room for the whole file plus headroom.
+    double memory_fraction = 0.5;          // Share of currently available memory one load may take.
+    double back_fraction = 0.25;           // Share of the budget kept for seeking backwards.
+
+    // Applies { "cache": { "host_cap_mb": 2048, "min_mb": 16, "max_mb": 1024, ... } }.
+    // Reservations already made keep their size until their owner loads again.
+    void configure(const nlohmann::json &config);
+    long long hostCapBytes();
+
+    // Computes the budget for a new load by owner (fileSize < 0 if unknown) and
+    // replaces owner's previous reservation with it.
+    Allocation acquire(const void *owner, long long fileSize);
+    void release(const void *owner);
+
+    long long reservedBytes();
+    // Available physical memory in bytes, or -1 if it cannot be determined.
+    static long long availableMemory();
+
+private:
+    std::mutex mutex;
+    std::unordered_map<const void*, long long> reservations;
+};
+
+#endif // CACHEBUDGET_H
@@ -0,0 +1,365 @@
+#include "Condition.h"
+#include "TimerWheel.h"
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+int64_t DeviceState::clockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(TimerWheel::now().time_since_epoch()).count();
+}
+
+void DeviceState::observe(const std::string &msg, int64_t nowMs) {
+    lastSeenMs.store(nowMs, std::memory_order_relaxed);
+    if (msg == "EOF" || msg == "ALTEOF" || msg == "ENDP") {
+        flags.fetch_or(ENDED, std::memory_order_relaxed);
+    } else if (msg.rfind("Loaded file: ", 0) == 0) {
+        flags.fetch_or(LOADED, std::memory_order_relaxed);
+        flags.fetch_and(~static_cast<uint32_t>(ENDED), std::memory_order_relaxed);
+    } else if (msg.rfind("STATE ", 0) == 0) {
+        json delta = json::parse(msg.begin() + 6, msg.end(), nullptr, false);
+        if (!delta.is_object())
+            return;
+        auto set = [this](uint32_t bit, bool on) {
+            if (on)
+                flags.fetch_or(bit, std::memory_order_relaxed);
+            else
+                flags.fetch_and(~bit, std::memory_order_relaxed);
+        };
+        if (delta.contains("pause") && delta["pause"].is_boolean())
+            set(PAUSED, delta["pause"].get<bool>());
+        if (delta.contains("eof") && delta["eof"].is_boolean())
+            set(ENDED, delta["eof"].get<bool>());
+        if (delta.contains("path") && delta["path"].is_string())
+            set(LOADED, !delta["path"].get<std::string>().empty());
+        if (delta.contains("pos"))
+            posMs.store(delta["pos"].is_number() ? std::llround(delta["pos"].get<double>() * 1000.0) : -1,
+                        std::memory_order_relaxed);
+    }
+}
+
+void DeviceState::copyFrom(const DeviceState &other) {
+    flags.store(other.flags.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    posMs.store(other.posMs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    lastSeenMs.store(other.lastSeenMs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+// Recursive descent over the source, emitting bytecode in postfix order.
+class ConditionParser {
+public:
+    ConditionParser(const std::string &src, const std::unordered_map<std::string, uint32_t> &deviceIds,
+                    Condition &out)
+        : src(src), deviceIds(deviceIds), out(out) {}
+
+    void parse() {
+        parseOr();
+        skipSpace();
+        if (pos != src.size())
+            fail("unexpected '" + src.substr(pos, 1) + "'");
+    }
+
+private:
+    using Op = Condition::Op;
+    const std::string &src;
+    const std::unordered_map<std::string, uint32_t> &deviceIds;
+    Condition &out;
+    size_t pos = 0;
+    int depth = 0;
+    // Recursion through unary operators and parentheses. The value stack does
+    // not grow on "!!!!..." or "((((...", so this is bounded separately.
+    static constexpr int MAX_NESTING = 128;
+    int nesting = 0;
+
+    struct Nest {
+        ConditionParser &parser;
+        explicit Nest(ConditionParser &p) : parser(p) {
+            if (++parser.nesting > MAX_NESTING)
+                parser.fail("expression nested too deeply");
+        }
+        ~Nest() { parser.nesting--; }
+    };
+
+    [[noreturn]] void fail(const std::string &why) {
+        throw Condition::Error(why + " at column " + std::to_string(pos + 1));
+    }
+
+    void emit(Op op, int stackDelta, uint32_t device = 0, double value = 0.0) {
+        out.code.push_back({op, device, value});
+        depth += stackDelta;
+        if (depth > Condition::MAX_STACK)
+            fail("expression too deep");
+    }
+
+    void skipSpace() {
+        while (pos < src.size() && std::isspace(static_cast<unsigned char>(src[pos])))
+            pos++;
+    }
+
+    bool accept(const char *token) {
+        skipSpace();
+        size_t len = std::char_traits<char>::length(token);
+        if (src.compare(pos, len, token) != 0)
+            return false;
+        // "<" must not swallow the start of "<=", nor "!" of "!=".
+        if (len == 1 && pos + 1 < src.size() && src[pos + 1] == '=' && std::string("<>!=").find(token[0]) != std::string::npos)
+            return false;
+        pos += len;
+        return true;
+    }
+
+    void parseOr() {
+        parseAnd();
+        while (accept("||")) {
+            parseAnd();
+            emit(Op::Or, -1);
+        }
+    }
+
+    void parseAnd() {
+        parseEquality();
+        while (accept("&&")) {
+            parseEquality();
+            emit(Op::And, -1);
+        }
+    }
+
+    void parseEquality() {
+        parseRelational();
+        while (true) {
+            Op op;
+            if (accept("=="))
+                op = Op::Eq;
+            else if (accept("!="))
+                op = Op::Ne;
+            else
+                return;
+            parseRelational();
+            emit(op, -1);
+        }
+    }
+
+    void parseRelational() {
+        parseAdditive();
+        while (true) {
+            Op op;
+            if (accept("<="))
+                op = Op::Le;
+            else if (accept(">="))
+                op = Op::Ge;
+            else if (accept("<"))
+                op = Op::Lt;
+            else if (accept(">"))
+                op = Op::Gt;
+            else
+                return;
+            parseAdditive();
+            emit(op, -1);
+        }
+    }
+
+    void parseAdditive() {
+        parseMultiplicative();
+        while (true) {
+            Op op;
+            if (accept("+"))
+                op = Op::Add;
+            else if (accept("-"))
+                op = Op::Sub;
+            else
+                return;
+            parseMultiplicative();
+            emit(op, -1);
+        }
+    }
+
+    void parseMultiplicative() {
+        parseUnary();
+        while (true) {
+            Op op;
+            if (accept("*"))
+                op = Op::Mul;
+            else if (accept("/"))
+                op = Op::Div;
+            else if (accept("%"))
+                op = Op::Mod;
+            else
+                return;
+            parseUnary();
+            emit(op, -1);
+        }
+    }
+
+    void parseUnary() {
+        Nest nest(*this);
+        if (accept("!")) {
+            parseUnary();
+            emit(Op::Not, 0);
+        } else if (accept("-")) {
+            parseUnary();
+            emit(Op::Neg, 0);
+        } else {
+            parsePrimary();
+        }
+    }
+
+    std::string identifier() {
+        skipSpace();
+        size_t start = pos;
+        while (pos < src.size() && (std::isalnum(static_cast<unsigned char>(src[pos])) || src[pos] == '_'))
+            pos++;
+        return src.substr(start, pos - start);
+    }
+
+    uint32_t deviceArgument() {
+        if (!accept("("))
+            fail("expected '('");
+        skipSpace();
+        std::string name;
+        if (pos < src.size() && (src[pos] == '\'' || src[pos] == '"')) {
+            size_t end = src.find(src[pos], pos + 1);
+            if (end == std::string::npos)
+                fail("unterminated device name");
+            name = src.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+        } else {
+            // Bare names may contain '-' and '.', as device names often do.
+            size_t start = pos;
+            while (pos < src.size() && (std::isalnum(static_cast<unsigned char>(src[pos])) ||
+                                        src[pos] == '_' || src[pos] == '-' || src[pos] == '.'))
+                pos++;
+            name = src.substr(start, pos - start);
+        }
+        auto it = deviceIds.find(name);
+        if (it == deviceIds.end())
+            fail("unknown device '" + name + "'");
+        if (!accept(")"))
+            fail("expected ')'");
+        return it->second;
+    }
+
+    void parsePrimary() {
+        skipSpace();
+        if (pos >= src.size())
+            fail("unexpected end");
+        if (accept("(")) {
+            Nest nest(*this);
+            parseOr();
+            if (!accept(")"))
+                fail("expected ')'");
+            return;
+        }
+        char c = src[pos];
+        if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+            char *end = nullptr;
+            double value = std::strtod(src.c_str() + pos, &end);
+            pos = end - src.c_str();
+            emit(Op::Const, 1, 0, value);
+            return;
+        }
+        std::string name = identifier();
+        static const std::unordered_map<std::string, Op> variables = {
+            {"count", Op::Count}, {"hour", Op::Hour}, {"minute", Op::Minute},
+            {"second", Op::Second}, {"weekday", Op::Weekday}, {"true", Op::Const}, {"false", Op::Const}};
+        static const std::unordered_map<std::string, Op> functions = {
+            {"idle", Op::Idle}, {"paused", Op::Paused}, {"eof", Op::Eof}, {"pos", Op::Pos}, {"since", Op::Since}};
+        auto var = variables.find(name);
+        if (var != variables.end()) {
+            emit(var->second, 1, 0, name == "true" ? 1.0 : 0.0);
+            return;
+        }
+        auto fn = functions.find(name);
+        if (fn != functions.end()) {
+            emit(fn->second, 1, deviceArgument());
+            return;
+        }
+        fail(name.empty() ? "unexpected '" + src.substr(pos, 1) + "'" : "unknown name '" + name + "'");
+    }
+};
+
+Condition Condition::compile(const std::string &source, const std::unordered_map<std::string, uint32_t> &deviceIds) {
+    Condition condition;
+    condition.source = source;
+    ConditionParser(source, deviceIds, condition).parse();
+    condition.code.shrink_to_fit();
+    return condition;
+}
+
+// Wall clock fields, recomputed at most once per second per thread.
+static const std::tm &localNow() {
+    thread_local std::time_t cachedSecond = -1;
+    thread_local std::tm cached{};
+    std::time_t now = TimerWheel::wallNow();
+    if (now != cachedSecond) {
+        cachedSecond = now;
+#ifdef _WIN32
+        localtime_s(&cached, &now);
+#else
+        localtime_r(&now, &cached);
+#endif
+    }
+    return cached;
+}
+
+bool Condition::evaluate(const ConditionContext &ctx) const {
+    double stack[MAX_STACK];
+    int top = 0;
+    for (const Instr &in : code) {
+        const DeviceState *dev = ctx.devices ? &ctx.devices[in.device] : nullptr;
+        switch (in.op) {
+        case Op::Const:   stack[top++] = in.value; break;
+        case Op::Count:   stack[top++] = ctx.count; break;
+        case Op::Hour:    stack[top++] = localNow().tm_hour; break;
+        case Op::Minute:  stack[top++] = localNow().tm_min; break;
+        case Op::Second:  stack[top++] = localNow().tm_sec; break;
+        case Op::Weekday: stack[top++] = localNow().tm_wday; break;
+        case Op::Idle: {
+            uint32_t f = dev ? dev->flags.load(std::memory_order_relaxed) : 0;
+            stack[top++] = !(f & DeviceState::LOADED) || (f & DeviceState::ENDED);
+            break;
+        }
+        case Op::Paused:
+            stack[top++] = dev && (dev->flags.load(std::memory_order_relaxed) & DeviceState::PAUSED);
+            break;
+        case Op::Eof:
+            stack[top++] = dev && (dev->flags.load(std::memory_order_relaxed) & DeviceState::ENDED);
+            break;
+        case Op::Pos: {
+            int64_t ms = dev ? dev->posMs.load(std::memory_order_relaxed) : -1;
+            stack[top++] = ms < 0 ? -1.0 : ms / 1000.0;
+            break;
+        }
+        case Op::Since: {
+            int64_t seen = dev ? dev->lastSeenMs.load(std::memory_order_relaxed) : -1;
+            stack[top++] = seen < 0 ? 1e18 : static_cast<double>(ctx.nowMs - seen);
+            break;
+        }
+        case Op::Not: stack[top - 1] = stack[top - 1] == 0.0; break;
+        case Op::Neg: stack[top - 1] = -stack[top - 1]; break;
+        default: {
+            double b = stack[--top];
+            double &a = stack[top - 1];
+            switch (in.op) {
+            case Op::Mul: a = a * b; break;
+            case Op::Div: a = b == 0.0 ? 0.0 : a / b; break;
+            case Op::Mod: a = b == 0.0 ? 0.0 : std::fmod(a, b); break;
+            case Op::Add: a = a + b; break;
+            case Op::Sub: a = a - b; break;
+            case Op::Lt:  a = a < b; break;
+            case Op::Le:  a = a <= b; break;
+            case Op::Gt:  a = a > b; break;
+            case Op::Ge:  a = a >= b; break;
+            case Op::Eq:  a = a == b; break;
+            case Op::Ne:  a = a != b; break;
+            case Op::And: a = a != 0.0 && b != 0.0; break;
+            case Op::Or:  a = a != 0.0 || b != 0.0; break;
+            default: break;
+            }
+        }
+        }
+    }
+    return top > 0 && stack[top - 1] != 0.0;
+}
@@ -0,0 +1,74 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What the controller last heard from a device, updated from its messages
+// (EOF/ENDP, "Loaded file: ...", STATE pushes) on the listener thread and
+// read by conditions on any thread.
+struct DeviceState {
+    enum : uint32_t { LOADED = 1, PAUSED = 2, ENDED = 4 };
+    std::atomic<uint32_t> flags{0};
+    std::atomic<int64_t> posMs{-1};        // Playback position, -1 if unknown.
+    std::atomic<int64_t> lastSeenMs{-1};   // Steady clock ms of the last message, -1 if never.
+
+    void observe(const std::string &msg, int64_t nowMs);
+    void copyFrom(const DeviceState &other);
+
+    // Steady clock in ms (TimerWheel::now()), the time base of lastSeenMs and ConditionContext::nowMs.
+    static int64_t clockMs();
+};
+
+// Inputs a condition reads; filled in by the caller, no allocation.
+struct ConditionContext {
+    const DeviceState *devices = nullptr;  // Indexed by CueTable device id.
+    uint32_t count = 0;                    // Firings of the cue, this one included.
+    int64_t nowMs = 0;                     // Steady clock.
+};
+
+// A cue or action condition compiled to stack-machine bytecode. The source is
+// a C-like expression over numbers:
+//   count, hour, minute, second, weekday (0 = Sunday)
+//   idle(DEV), paused(DEV), eof(DEV), pos(DEV) seconds, since(DEV) ms
+//   ! - * / % + - < <= > >= == != && || and parentheses
+// DEV is a device name, bare or quoted. Zero is false, anything else true.
+class Condition {
+public:
+    struct Error : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // Resolves device names through deviceIds. Throws Condition::Error.
+    static Condition compile(const std::string &source, const std::unordered_map<std::string, uint32_t> &deviceIds);
+
+    bool evaluate(const ConditionContext &ctx) const;
+
+    size_t codeBytes() const { return code.capacity() * sizeof(Instr); }
+    const std::string &text() const { return source; }
+
+private:
+    enum class Op : uint8_t {
+        Const, Count, Hour, Minute, Second, Weekday,
+        Idle, Paused, Eof, Pos, Since,
+        Not, Neg, Mul, Div, Mod, Add, Sub,
+        Lt, Le, Gt, Ge, Eq, Ne, And, Or
+    };
+    struct Instr {
+        Op op;
+        uint32_t device;  // For the device functions.
+        double value;     // For Const.
+    };
+    static constexpr int MAX_STACK = 32;
+
+    std::string source;
+    std::vector<Instr> code;
+
+    friend class ConditionParser;
+};
+
+#endif // CONDITION_H
@@ -0,0 +1,104 @@
+#include "Config.h"
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+const char *const CONFIG_PATH = "player.json";
+
+bool readConfigFile(const std::string &path, json &config) {
+    std::ifstream configFile(path);
+    if (!configFile) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    try {
+        configFile >> config;
+    } catch (json::parse_error &e) {
+        std::cerr << "JSON parse error: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<json> playerConfigs(const json &config) {
+    std::vector<json> configs;
+    if (config.contains("players") && config["players"].is_array()) {
+        for (const auto &entry : config["players"]) {
+            json merged = config;
+            merged.erase("players");
+            merged.update(entry);
+            configs.push_back(merged);
+        }
+    } else {
+        configs.push_back(config);
+    }
+    return configs;
+}
+
+bool readRange(const json &config, const char *key, int &min, int &max) {
+    if (!config.contains(key))
+        return true;
+    const json &range = config[key];
+    if (!range.is_array() || range.size() != 2 || !range[0].is_number_integer() || !range[1].is_number_integer())
+        return false;
+    min = range[0].get<int>();
+    max = range[1].get<int>();
+    return min <= max;
+}
+
+bool readRandomClips(const json &config, std::vector<std::string> &clips, int &waitMinMs, int &waitMaxMs,
+                     int &lengthMin, int &lengthMax, std::string &error) {
+    if (config.contains("clips") && config["clips"].is_array()) {
+        for (const auto &clip : config["clips"])
+            if (clip.is_string())
+                clips.push_back(clip.get<std::string>());
+    }
+    if (clips.empty()) {
+        error = "no clips";
+        return false;
+    }
+    if (!readRange(config, "wait_ms", waitMinMs, waitMaxMs) || waitMinMs < 0) {
+        error = "wait_ms must be [min, max] with 0 <= min <= max";
+        return false;
+    }
+    if (!readRange(config, "sequence_length", lengthMin, lengthMax) || lengthMin < 1) {
+        error = "sequence_length must be [min, max] with 1 <= min <= max";
+        return false;
+    }
+    return true;
+}
+
+ReloadQueue::ReloadQueue(std::function<void()> reload) : reload(std::move(reload)) {
+}
+
+ReloadQueue::~ReloadQueue() {
+    stop();
+}
+
+void ReloadQueue::request() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queued || stopped)
+        return;
+    queued = true;
+    if (running)
+        return; // The running thread picks it up when its reload is done.
+    running = true;
+    std::thread([this]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (queued) {
+            queued = false;
+            lock.unlock();
+            reload();
+            lock.lock();
+        }
+        running = false;
+        done.notify_all();
+    }).detach();
+}
+
+void ReloadQueue::stop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopped = true;
+    queued = false;
+    done.wait(lock, [this] { return !running; });
+}
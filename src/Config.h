@@ -0,0 +1,55 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Configuration file read at startup and on RELOAD / SIGHUP.
+extern const char *const CONFIG_PATH;
+
+// Parses a JSON config file; on failure prints the error and returns false.
+bool readConfigFile(const std::string &path, json &config);
+
+// One config object per player: the top-level keys merged with each entry of
+// a "players" array, or just the top-level config when there is no array.
+std::vector<json> playerConfigs(const json &config);
+
+// Reads an optional "[min, max]" pair of integers with min <= max; false if
+// the key is present but not such a pair.
+bool readRange(const json &config, const char *key, int &min, int &max);
+
+// Reads the clips, wait_ms and sequence_length of a player random profile or
+// a controller generator. Refuses anything that could play a bare PLAY, draw
+// an invalid wait or an empty sequence, with the reason in error.
+bool readRandomClips(const json &config, std::vector<std::string> &clips, int &waitMinMs, int &waitMaxMs,
+                     int &lengthMin, int &lengthMax, std::string &error);
+
+// Runs a reload callback on a background thread, one reload at a time.
+// Requests made while one is waiting are folded into it, so a flood of
+// RELOADs costs one thread and the reloads apply in order.
+class ReloadQueue {
+public:
+    explicit ReloadQueue(std::function<void()> reload);
+    ~ReloadQueue();
+
+    void request();
+    // Drops a queued reload and waits for a running one. Call it before the
+    // state the callback uses is torn down; no reload runs afterwards.
+    void stop();
+
+private:
+    std::function<void()> reload;
+    std::mutex mutex;            // Guards the three below.
+    bool queued = false;         // A requested reload has not started yet.
+    bool running = false;        // The reload thread is alive.
+    bool stopped = false;        // stop() was called; requests are ignored.
+    std::condition_variable done;  // stop() waits on it for the reload thread.
+};
+
+#endif // CONFIG_H
@@ -1,4 +1,7 @@
 #include "Controller.h"
+#include "Config.h"
+#include <algorithm>
+#include <sstream>
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -24,73 +27,255 @@ Controller::Controller()
     : udp_listen_port(12346),    // You can adjust these defaults as needed.
       udp_send_port(12345),
       controller_ip("255.255.255.255"),
-      udp(nullptr)
+      udp(nullptr),
+      table(std::make_shared<CueTable>()),
+      generators(std::make_shared<GeneratorSet>()),
+      reloads([this]() { reload(); })
 
 {
 }
 
+void Controller::configure(const json &config) {
+    std::lock_guard<std::mutex> configureLock(configureMutex);
+    // Everything that can throw on a wrong-typed field is read and built
+    // before anything is swapped in, so a bad config leaves the current state.
+    int lateActionMs = config.value("late_action_ms", late_action_ms.load());
+    int timeoutMs, probeMs;
+    std::vector<std::string> required;
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        timeoutMs = startup_timeout_ms;
+        probeMs = startup_probe_interval_ms;
+        required = startup_required;
+    }
+    if (config.contains("startup") && config["startup"].is_object()) {
+        const json &startup = config["startup"];
+        timeoutMs = startup.value("timeout_ms", timeoutMs);
+        probeMs = std::max(10, startup.value("probe_interval_ms", probeMs));
+        required = startup.value("required_devices", required);
+    }
+    auto next = CueTable::build(config, udp_send_port);
+    json nextGenerators = config.value("generators", json::array());
+
+    late_action_ms.store(lateActionMs);
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        startup_timeout_ms = timeoutMs;
+        startup_probe_interval_ms = probeMs;
+        startup_required = required;
+    }
+    // Device state survives a reload; counters start again.
+    next->inheritDeviceStates(*std::atomic_load(&table));
+    std::atomic_store(&table, next);
+    {
+        std::lock_guard<std::mutex> lock(generatorMutex);
+        generatorConfig = std::move(nextGenerators);
+    }
+    startGenerators(false);
+}
+
+void Controller::reload() {
+    json config;
+    if (!readConfigFile(CONFIG_PATH, config)) {
+        std::cout << "RELOAD failed, keeping the current cues" << std::endl;
+        return;
+    }
+    // The new table is built before the swap; in-flight cues finish on the old one.
+    try {
+        configure(config);
+    } catch (const json::exception &e) {
+        std::cout << "RELOAD failed, keeping the current cues: " << e.what() << std::endl;
+        return;
+    }
+    std::cout << "RELOAD complete" << std::endl;
+}
+
 Controller::~Controller() {
+    reloads.stop();
+    scheduler.stop();
     // If necessary, add a mechanism to stop the UDP listener.
     if (udp) {
         delete udp;
     }
-    if (dotsBS1) {
-        delete dotsBS1;
+}
+void Controller::processStartupComplete() {
+    auto current = std::atomic_load(&table);
+    for (uint32_t cueIndex : current->startupCues) {
+        const CompiledCue &cue = current->cues[cueIndex];
+        std::cout << "Startup cue triggered: " << current->cueNames[cue.nameId] << std::endl;
+        if (Journal *journal = Journal::active())
+            journal->append(Journal::CUE, current->cueNames[cue.nameId]);
+
+        uint32_t count = current->recordFiring(cueIndex);
+        if (!current->conditionHolds(cue.condition, count))
+            continue;
+        // Immediately process each action in the cue.
+        runActions(*current, cue.firstAction, cue.actionCount, count);
     }
-    if (dotsBS2) {
-        delete dotsBS2;
+    startGenerators(true);
+}
+
+void Controller::startGenerators(bool atStartup) {
+    std::lock_guard<std::mutex> lock(generatorMutex);
+    if (atStartup)
+        generatorsLive = true;
+    else if (!generatorsLive)
+        return; // A reload before startup; the startup cues start them.
+    std::seed_seq seq{random_seed, generatorBuilds++};
+    uint32_t seed;
+    seq.generate(&seed, &seed + 1);
+    auto next = GeneratorSet::build(generatorConfig, *std::atomic_load(&table), udp, scheduler, seed);
+    auto previous = std::atomic_load(&generators);
+    // Read before stop(), which switches every old sender off.
+    next->inheritStates(*previous);
+    previous->stop();
+    std::atomic_store(&generators, std::shared_ptr<const GeneratorSet>(next));
+    next->start();
+}
+
+
+void Controller::waitForDevices() {
+    auto current = std::atomic_load(&table);
+    std::vector<std::string> required;
+    int timeoutMs, probeMs;
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        required = startup_required;
+        timeoutMs = startup_timeout_ms;
+        probeMs = startup_probe_interval_ms;
     }
+    if (required.empty())
+        required = defaultRequiredDevices(*current);
+    std::cout << "waiting up to " << timeoutMs << " ms for " << required.size()
+              << " devices before running startup commands" << std::endl;
+
+    auto deadline = startedAt + std::chrono::milliseconds(timeoutMs);
+    std::unique_lock<std::mutex> lock(readyMutex);
+    while (true) {
+        std::vector<std::string> waiting;
+        for (const auto &name : required)
+            if (!readyAfterMs.count(name))
+                waiting.push_back(name);
+        if (waiting.empty() || std::chrono::steady_clock::now() >= deadline)
+            break;
+        lock.unlock();
+        for (const auto &name : waiting) {
+            auto id = current->deviceIds.find(name);
+            if (id == current->deviceIds.end() || current->deviceIps[id->second].empty())
+                continue;
+            int port = current->devicePorts[id->second] ? current->devicePorts[id->second] : udp_send_port;
+            udp->sendUdpMessage("STATUS", current->deviceIps[id->second], port);
+        }
+        lock.lock();
+        readyChanged.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() +
+                                                             std::chrono::milliseconds(probeMs)));
+    }
+
+    // Per-device readiness, then one summary line.
+    long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startedAt).count();
+    size_t ready = 0;
+    for (const auto &name : required) {
+        auto it = readyAfterMs.find(name);
+        if (it != readyAfterMs.end()) {
+            ready++;
+            std::cout << "startup: " << name << " ready after " << it->second << " ms" << std::endl;
+        } else {
+            std::cout << "startup: " << name << " NOT ready" << std::endl;
+        }
+    }
+    startupReport = "startup ready=" + std::to_string(ready) + "/" + std::to_string(required.size()) +
+                    " after_ms=" + std::to_string(elapsed) + (ready < required.size() ? " timeout" : "");
+    std::cout << startupReport << std::endl;
 }
-void Controller::processStartupComplete() {
-    for (auto &cue : cues) {
-        if (cue.contains("trigger") && cue["trigger"].contains("type") &&
-            cue["trigger"]["type"] == "startup_complete")
-        {
-            std::string cueName = cue["name"].get<std::string>();
-            std::cout << "Startup cue triggered: " << cueName << std::endl;
-
-            // Immediately process each action in the cue.
-            if (cue.contains("actions") && cue["actions"].is_array()) {
-                for (auto &action : cue["actions"]) {
-                    if (action.contains("type") && action["type"] == "send_udp") {
-                        std::string actionMessage = action.value("message", "");
-                        // Send UDP message to each destination immediately.
-                        if (action.contains("destination") && action["destination"].is_array()) {
-                            for (auto &dest : action["destination"]) {
-                                std::string destName = dest.get<std::string>();
-                                if (devices.find(destName) != devices.end()) {
-                                    std::string destIp = devices.at(destName);
-                                    udp->sendUdpMessage(actionMessage, destIp, udp_send_port);
-                                }
-                            }
-                        }
-                    }
-                }
+
+std::vector<std::string> Controller::defaultRequiredDevices(const CueTable &current) {
+    // Devices marked "player": true. Without any, the devices the controller
+    // hears from (a trigger's from_device) or plays generator clips on, since
+    // lighting and other output-only devices never answer STATUS. "player":
+    // false always excludes a device.
+    bool anyMarked = std::find(current.devicePlayer.begin(), current.devicePlayer.end(), 1) !=
+                     current.devicePlayer.end();
+    std::vector<char> wanted(current.configuredDevices, 0);
+    for (uint32_t id = 0; id < current.configuredDevices; id++) {
+        if (anyMarked)
+            wanted[id] = current.devicePlayer[id] == 1;
+        else
+            wanted[id] = id < current.deviceHeardFrom.size() && current.deviceHeardFrom[id];
+    }
+    if (!anyMarked) {
+        std::lock_guard<std::mutex> lock(generatorMutex);
+        for (const auto &g : generatorConfig) {
+            if (!g.is_object() || !g.contains("devices") || !g["devices"].is_array())
+                continue;
+            for (const auto &name : g["devices"]) {
+                if (!name.is_string())
+                    continue;
+                auto id = current.deviceIds.find(name.get<std::string>());
+                if (id != current.deviceIds.end() && id->second < current.configuredDevices)
+                    wanted[id->second] = 1;
             }
         }
     }
-    // Now load the RandomizedSender instances for dotsBS1 and dotsBS2.
-    auto it1 = devices.find("BS1");
-    if (it1 != devices.end()) {
-        dotsBS1 = new RandomizedSender("dotsBS1", it1->second, udp);
-        std::cout << "Initialized RandomizedSender dotsBS1" << std::endl;
-    } else {
-        std::cout << "Device dotsBS1 not found in devices list." << std::endl;
+    std::vector<std::string> required;
+    for (uint32_t id = 0; id < current.configuredDevices; id++)
+        if (wanted[id] && current.devicePlayer[id] != 0 && !current.deviceIps[id].empty())
+            required.push_back(current.deviceNames[id]);
+    return required;
+}
+
+void Controller::noteDeviceMessage(const std::string &senderName, const std::string &msg) {
+    bool status = msg.rfind("STATUS ", 0) == 0 || msg == "READY";
+    bool firstFrame = msg.rfind("FIRSTFRAME ", 0) == 0;
+    if (!status && !firstFrame)
+        return;
+    long long sinceStart = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startedAt).count();
+    if (firstFrame) {
+        // The player's own boot_ms is in the message; this adds the controller's view.
+        std::cout << "first frame on " << senderName << " " << sinceStart << " ms after controller start ("
+                  << msg.substr(11) << ")" << std::endl;
     }
+    std::lock_guard<std::mutex> lock(readyMutex);
+    if (readyAfterMs.emplace(senderName, sinceStart).second)
+        readyChanged.notify_all();
+}
 
-    auto it2 = devices.find("BS2");
-    if (it2 != devices.end()) {
-        dotsBS2 = new RandomizedSender("dotsBS2", it2->second, udp);
-        std::cout << "Initialized RandomizedSender dotsBS2" << std::endl;
-    } else {
-        std::cout << "Device dotsBS2 not found in devices list." << std::endl;
+std::string Controller::statsReport() {
+    std::string report = "STATS " + scheduler.report() + " actions " + actionError.summary() +
+                         " fanout " + fanoutTime.summary();
+    // Suppressed triggers in total by reason, then per cue.
+    auto current = std::atomic_load(&table);
+    report += " suppressed coalesced=" + std::to_string(current->suppressedTotals[CueTable::COALESCED].load()) +
+              " min_interval=" + std::to_string(current->suppressedTotals[CueTable::TOO_SOON].load()) +
+              " max_pending=" + std::to_string(current->suppressedTotals[CueTable::TOO_MANY_PENDING].load());
+    std::string perCue;
+    for (uint32_t i = 0; i < current->cues.size(); i++) {
+        uint32_t n = current->guards[i].suppressed.load(std::memory_order_relaxed);
+        if (n)
+            perCue += (perCue.empty() ? "" : ",") + current->cueNames[current->cues[i].nameId] + ":" +
+                      std::to_string(n);
     }
+    if (!perCue.empty())
+        report += " by_cue=" + perCue;
+    std::lock_guard<std::mutex> lock(readyMutex);
+    if (!startupReport.empty())
+        report += " " + startupReport;
+    return report;
 }
 
+void Controller::startOffline() {
+    startedAt = std::chrono::steady_clock::now();
+    udp = new UdpComm(udp_listen_port, udp_send_port, controller_ip);
+    scheduler.start();
+    processStartupComplete();
+}
 
 void Controller::start() {
+    startedAt = std::chrono::steady_clock::now();
     // Create the UdpComm instance using the controller’s configuration.
     udp = new UdpComm(udp_listen_port, udp_send_port, controller_ip);
+    scheduler.start();
     // udp->sendLog("Controller: UDP Listener started on port " + std::to_string(udp_listen_port));
 
     // Start the UDP listener in a separate thread.
@@ -99,166 +284,236 @@ void Controller::start() {
             processIncomingMessage(msg, src, srcLen);
         });
     });
-    std::cout << "waiting 3s for initialisation before running startup commands" << std::endl;
-    std::this_thread::sleep_for(std::chrono::milliseconds(3000));
-
+    waitForDevices();
     processStartupComplete(); // or whatever your device name is
 
-    dotsBS1->setOnOff(true);
-    dotsBS2->setOnOff(true);
-    std::thread([this]() { dotsBS1->scheduleNext(); }).detach();
-    std::thread([this]() { dotsBS2->scheduleNext(); }).detach();
-
     listenerThread.join();
 }
 
-void Controller::processIncomingMessage(const std::string &msg, const sockaddr_in &src, socklen_t srcLen) {
-    // Get the sender's IP address as a string.
-    char senderIP[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &src.sin_addr, senderIP, sizeof(senderIP));
-    std::string senderName = "Unknown";
-    // std::cout << "senderIP: " << senderIP << std::endl;
-    // Print all devices in the map to check if they're properly populated
-    for (const auto &d : devices) {
-        // Use a more robust comparison
-        if (std::string(senderIP) == d.second) {
-            senderName = d.first;
-            break;
-        }
+void Controller::sendAction(const CueTable &table, const CompiledAction &action) {
+    const std::string &message = table.messages[action.messageId];
+    if (Journal *journal = Journal::active())
+        journal->append(Journal::ACTION, message);
+    if (action.control) {
+        timelineCommand(message);
+        return;
     }
+    // The destinations, groups already expanded, go out as one batch.
+    auto started = std::chrono::steady_clock::now();
+    udp->sendBatch(message, table.endpoints.data() + action.firstDestination, action.destinationCount);
+    if (action.destinationCount > 1) {
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        fanoutTime.record(std::chrono::duration<double, std::milli>(elapsed).count());
+    }
+}
 
+void Controller::runActions(const CueTable &table, uint32_t first, uint32_t count, uint32_t fired) {
+    for (uint32_t i = first; i < first + count; i++) {
+        if (table.conditionHolds(table.actions[i].condition, fired))
+            sendAction(table, table.actions[i]);
+    }
+}
 
-    std::cout << senderName << "says: " << msg << std::endl;
-
+void Controller::sendActionAt(const CueTable &table, uint32_t index, uint32_t count,
+                              TimerWheel::Clock::time_point deadline) {
+    const CompiledAction &action = table.actions[index];
+    if (!table.conditionHolds(action.condition, count))
+        return;
+    sendAction(table, action);
+    double errorMs = std::chrono::duration<double, std::milli>(TimerWheel::now() - deadline).count();
+    actionError.record(errorMs);
+    if (errorMs > late_action_ms.load(std::memory_order_relaxed))
+        std::cout << "late action: " << table.messages[table.actions[index].messageId] << " sent "
+                  << errorMs << " ms after its deadline" << std::endl;
+}
 
-    // Iterate over cues to check if any should be triggered by this message.
-
-    // Check each cue to see if it should fire.
-    for (auto &cue : cues) {
-        // Must have trigger type "udp_message" to handle here.
-        if (cue.contains("trigger") && cue["trigger"].contains("type") &&
-            cue["trigger"]["type"] == "udp_message")
-        {
-            std::string triggerMessage = cue["trigger"].value("message", "");
-            std::string triggerFrom    = cue["trigger"].value("from_device", "");
-            int triggerDelay           = cue["trigger"].value("delay_ms", 0);
-
-            // Optional: how often to do "alternate_actions"
-            // If not set, default to 1 (meaning "alternate_actions" never used unless 1 is also doing that logic).
-            int countRequirement = cue["trigger"].value("count", 1);
-
-            // Check if message & sender match
-            if (msg == triggerMessage && senderName == triggerFrom) {
-                // Cue triggered.
-                std::string cueName = cue["name"].get<std::string>();
-                std::cout << "cue triggered: " << cueName << std::endl;
-
-                // Increment the times this cue has fired.
-                cueFiredCount[cueName]++;
-
-                // Fire the cue in a separate thread for delay & concurrency.
-                std::thread([=]() {
-                    // Delay if specified
-                    if (triggerDelay > 0) {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(triggerDelay));
-                    }
-
-                    // Determine if we use alternate_actions
-                    int firedSoFar   = cueFiredCount.at(cueName);
-                    bool useAlternate = false;
-
-
-                    if (cue.contains("alternate_actions") && cue["alternate_actions"].is_array()) {
-                        std::cout << "firedsofar is: " << firedSoFar << std::endl;
-                        if (firedSoFar == countRequirement) {
-                      useAlternate = true;
-                      cueFiredCount[cueName] = 0;
-                  }
-                        std::cout << "using alternate? " << useAlternate << std::endl;
-
-                    }
-
-                    // If "alternate_actions" array is present and it's time to use it
-                    if (useAlternate && cue.contains("alternate_actions") && cue["alternate_actions"].is_array()) {
-                        for (auto &action : cue["alternate_actions"]) {
-                            if (action.contains("type") && action["type"] == "send_udp") {
-                                std::string actionMessage = action.value("message", "");
-                                int actionDelay           = action.value("delay_ms", 0);
-                                if (actionDelay > 0) {
-                                    std::this_thread::sleep_for(std::chrono::milliseconds(actionDelay));
-                                }
-                                // Send to each destination
-                                if (action.contains("destination") && action["destination"].is_array()) {
-                                    for (auto &dest : action["destination"]) {
-                                        std::string destName = dest.get<std::string>();
-                                        if (devices.find(destName) != devices.end()) {
-                                            std::string destIp = devices.at(destName);
-                                            udp->sendUdpMessage(actionMessage, destIp, udp_send_port);
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    // Otherwise, default to normal "actions" if it exists
-                    else if (cue.contains("actions") && cue["actions"].is_array()) {
-                        for (auto &action : cue["actions"]) {
-                            if (action.contains("type") && action["type"] == "send_udp") {
-                                std::string actionMessage = action.value("message", "");
-                                int actionDelay           = action.value("delay_ms", 0);
-                                if (actionDelay > 0) {
-                                    std::this_thread::sleep_for(std::chrono::milliseconds(actionDelay));
-                                }
-                                // Send to each destination
-                                if (action.contains("destination") && action["destination"].is_array()) {
-                                    for (auto &dest : action["destination"]) {
-                                        std::string destName = dest.get<std::string>();
-                                        if (devices.find(destName) != devices.end()) {
-                                            std::string destIp = devices.at(destName);
-                                            udp->sendUdpMessage(actionMessage, destIp, udp_send_port);
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-
-                }).detach();
-            }
+void Controller::scheduleActions(std::shared_ptr<const CueTable> current, uint32_t first, uint32_t end,
+                                 uint32_t count, TimerWheel::Clock::time_point cueTime) {
+    for (uint32_t i = first; i < end; i++) {
+        auto deadline = cueTime + std::chrono::milliseconds(current->actions[i].offsetTicks);
+        if (deadline <= TimerWheel::now()) {
+            sendActionAt(*current, i, count, deadline);
+            continue;
         }
+        // The timer holds the table, so the compiled actions outlive a reload.
+        scheduler.schedule(deadline, [this, current, i, count, deadline]() {
+            sendActionAt(*current, i, count, deadline);
+        });
     }
-    // NEW: Check if the message is "ENDP" and call scheduleNext on the corresponding RandomizedSender
-    if (msg == "ENDP") {
-        if (senderName == "BS1") {
-            if (dotsBS1) {
-                dotsBS1->sendUdpMessage("STOPCL");
-                std::thread([this]() { dotsBS1->scheduleNext(); }).detach();
-            }
-        }
-        else if (senderName == "BS2") {
-            if (dotsBS2) {
-                dotsBS2->sendUdpMessage("STOPCL");
-                std::thread([this]() { dotsBS2->scheduleNext(); }).detach();
-            }
+}
+
+void Controller::fireCue(std::shared_ptr<const CueTable> current, uint32_t cueIndex) {
+    const CompiledCue &cue = current->cues[cueIndex];
+    const std::string &cueName = current->cueNames[cue.nameId];
+
+    // Storm protection comes first: a suppressed trigger is not logged,
+    // journaled or counted, except for one log line per burst.
+    CueTable::Admission admission = current->admitFiring(cueIndex, DeviceState::clockMs());
+    if (admission != CueTable::ADMITTED) {
+        CueGuard &guard = current->guards[cueIndex];
+        if (!guard.reported.exchange(true, std::memory_order_relaxed)) {
+            static const char *reasons[] = {"", "coalesced", "min_interval_ms", "max_pending"};
+            std::cout << "cue suppressed: " << cueName << " (" << reasons[admission] << ", "
+                      << guard.suppressed.load(std::memory_order_relaxed) << " suppressed so far)" << std::endl;
         }
+        return;
     }
-        if (msg == "EOF") {
-            if (senderName == "AnaPC") {
-                if (dotsBS1)
-                    dotsBS1->setOnOff(false);
-                if (dotsBS2)
-                    dotsBS2->setOnOff(false);
-            }
-        }
-        if (msg == "EOF") {
-            if (senderName == "VIDEOPC2") {
-                if (dotsBS1)
-                    dotsBS1->setOnOff(true);
-                std::thread([this]() { dotsBS1->scheduleNext(); }).detach();
-                if (dotsBS2)
-                    dotsBS2->setOnOff(true);
-                std::thread([this]() { dotsBS2->scheduleNext(); }).detach();
-            }
+
+    std::cout << "cue triggered: " << cueName << std::endl;
+    if (Journal *journal = Journal::active())
+        journal->append(Journal::CUE, cueName);
+
+    uint32_t count = current->recordFiring(cueIndex);
+    if (!current->conditionHolds(cue.condition, count)) {
+        std::cout << "condition false: " << current->conditions[cue.condition].text() << std::endl;
+        current->releaseFiring(cueIndex);
+        return;
+    }
+
+    // Decide between actions and alternate_actions now, on the listener
+    // thread, so bursts of the same trigger are counted in arrival order.
+    bool useAlternate = current->countFiring(cueIndex);
+    if (cue.hasAlternates)
+        std::cout << "using alternate? " << useAlternate << std::endl;
+
+    // Every deadline below derives from the moment the trigger arrived. A
+    // coalesced cue fires when its window closes. A cue with no delay runs
+    // here on the listener thread; the wheel would round it up to the next tick.
+    uint32_t waitTicks = cue.delayTicks + cue.coalesceTicks;
+    auto cueTime = TimerWheel::now() + std::chrono::milliseconds(waitTicks);
+    if (waitTicks == 0) {
+        runCue(current, cueIndex, count, cueTime, useAlternate);
+        return;
+    }
+    scheduler.schedule(cueTime, [this, current, cueIndex, count, cueTime, useAlternate]() {
+        runCue(current, cueIndex, count, cueTime, useAlternate);
+    });
+}
+
+void Controller::runCue(std::shared_ptr<const CueTable> current, uint32_t cueIndex, uint32_t count,
+                        TimerWheel::Clock::time_point cueTime, bool useAlternate) {
+    const CompiledCue &cue = current->cues[cueIndex];
+    if (useAlternate)
+        scheduleActions(current, cue.firstAlternate, cue.firstAlternate + cue.alternateCount, count, cueTime);
+    else
+        scheduleActions(current, cue.firstAction, cue.firstAction + cue.actionCount, count, cueTime);
+    // The firing stops counting toward max_pending once its last action is due.
+    if (!cue.maxPending)
+        return;
+    if (cue.spanTicks == 0)
+        current->releaseFiring(cueIndex);
+    else
+        scheduler.schedule(cueTime + std::chrono::milliseconds(cue.spanTicks),
+                           [current, cueIndex]() { current->releaseFiring(cueIndex); });
+}
+
+std::string Controller::timelineCommand(const std::string &command) {
+    std::istringstream in(command);
+    std::string verb, name;
+    in >> verb >> name;
+    std::transform(verb.begin(), verb.end(), verb.begin(), ::toupper);
+
+    auto current = std::atomic_load(&table);
+    std::shared_ptr<Timeline> timeline;
+    {
+        std::lock_guard<std::mutex> lock(timelineMutex);
+        auto it = timelines.find(name);
+        if (it != timelines.end()) {
+            timeline = it->second;
+        } else if (verb == "START") {
+            if (!current->timelineIds.count(name))
+                return "TIMELINE error: unknown timeline " + name;
+            timeline = std::make_shared<Timeline>(name, scheduler,
+                [this](const CueTable &table, uint32_t action, uint32_t run, TimerWheel::Clock::time_point deadline) {
+                    sendActionAt(table, action, run, deadline);
+                });
+            timelines[name] = timeline;
+        } else {
+            return "TIMELINE error: " + name + " has not been started";
         }
     }
 
+    if (verb == "START") {
+        // A start picks up the timeline as defined by the current config.
+        auto id = current->timelineIds.find(name);
+        if (id == current->timelineIds.end())
+            return "TIMELINE error: unknown timeline " + name;
+        timeline->start(current, current->timelines[id->second]);
+    } else if (verb == "PAUSE") {
+        timeline->pause();
+    } else if (verb == "RESUME") {
+        timeline->resume();
+    } else if (verb == "SEEK") {
+        long long positionMs = 0;
+        if (!(in >> positionMs))
+            return "TIMELINE error: expected SEEK <name> <ms>";
+        timeline->seek(positionMs);
+    } else if (verb == "STOP") {
+        timeline->stop();
+    } else if (verb != "STATUS") {
+        return "TIMELINE error: unknown command " + verb;
+    }
+    return timeline->status();
+}
+
+void Controller::processIncomingMessage(const std::string &msg, const sockaddr_in &src, socklen_t srcLen) {
+    // RELOAD rebuilds the tables on the reload thread, away from the listener.
+    if (msg == "RELOAD") {
+        requestReload();
+        return;
+    }
+    // TIMELINE <command> controls a timeline and replies with its status.
+    if (msg.rfind("TIMELINE ", 0) == 0) {
+        char ip[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &src.sin_addr, ip, sizeof(ip));
+        std::string reply = timelineCommand(msg.substr(9));
+        std::cout << reply << std::endl;
+        udp->sendUdpMessage(reply, ip, ntohs(src.sin_port));
+        return;
+    }
+    // STATS reports scheduler firing accuracy back to the sender.
+    if (msg == "STATS") {
+        char ip[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &src.sin_addr, ip, sizeof(ip));
+        std::string report = statsReport();
+        std::cout << report << std::endl;
+        udp->sendUdpMessage(report, ip, ntohs(src.sin_port));
+        return;
+    }
+
+    // One table for the whole message; cue threads keep it alive after a reload.
+    auto current = std::atomic_load(&table);
+
+    // Identify the sender from its binary address: at most two hash probes,
+    // with no per-sender state, so ephemeral source ports cost no memory.
+    uint32_t senderId = current->identifySender(src.sin_addr.s_addr, src.sin_port);
+    static const std::string unknownName = "Unknown";
+    const std::string &senderName = senderId == CueTable::NO_DEVICE ? unknownName : current->deviceNames[senderId];
+
+    std::cout << senderName << "says: " << msg << std::endl;
+    if (senderId < current->deviceNames.size())
+        current->deviceStates[senderId].observe(msg, DeviceState::clockMs());
+    noteDeviceMessage(senderName, msg);
+
+
+    // Player watch point events look like "TIMEPOS <label> at=.. pos=.. late_ms=..".
+    std::string timePosLabel;
+    if (msg.rfind("TIMEPOS ", 0) == 0)
+        timePosLabel = msg.substr(8, msg.find(' ', 8) - 8);
+
+    // Cue triggers are matched against the message and the sender in one pass
+    // over the compiled patterns. A TIMEPOS line is also matched by its label
+    // against time_pos triggers; udp_message triggers still see the whole line.
+    matchedCues.clear();
+    current->match(false, msg, senderId, matchedCues);
+    if (!timePosLabel.empty()) {
+        size_t messageHits = matchedCues.size();
+        current->match(true, timePosLabel, senderId, matchedCues);
+        // Each cue has one trigger, so the two runs are disjoint; merge them into config order.
+        std::inplace_merge(matchedCues.begin(), matchedCues.begin() + messageHits, matchedCues.end());
+    }
+    for (uint32_t cueIndex : matchedCues)
+        fireCue(current, cueIndex);
+    // Generator triggers (advance on ENDP, enable/disable on EOF, ...).
+    std::atomic_load(&generators)->dispatch(msg, senderName);
+}
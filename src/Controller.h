@@ -1,17 +1,26 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <cstring>
+#include <random>
 #include "json.hpp"
 #include "UdpComm.h"
 #include "RandomizedSender.h"
+#include "CueTable.h"
+#include "TimerWheel.h"
+#include "Histogram.h"
+#include "Timeline.h"
+#include "Journal.h"
+#include "Config.h"
 
 
 #ifdef _WIN32
@@ -38,32 +47,123 @@ public:
     int udp_listen_port;    // UDP receiving port.
     int udp_send_port;      // UDP sending port.
     std::string controller_ip;  // Used as the broadcast/destination IP.
+    std::atomic<int> late_action_ms{5};  // Actions sent later than this after their deadline are logged.
+    uint32_t random_seed = std::random_device{}();  // The generators' engines derive from it.
+
+    // Readiness barrier before the startup cues ("startup" in the config).
+    int startup_timeout_ms = 10000;         // Run the startup cues anyway after this.
+    int startup_probe_interval_ms = 250;    // STATUS probes to devices not yet ready.
+    std::vector<std::string> startup_required;  // Devices to wait for; empty = defaultRequiredDevices().
+
+    // Builds the device and cue tables from a config object and swaps them in.
+    // Calls are serialised, so the last one to start is the one that stays.
+    // Throws json::exception on a wrong-typed field, having changed nothing.
+    void configure(const json &config);
+    // Re-reads the config file and swaps in the new tables; on a bad file the
+    // current ones stay.
+    void reload();
+    // Runs reload() on the reload thread (see ReloadQueue).
+    void requestReload() { reloads.request(); }
 
-    // Map of device names to their IP addresses.
-    std::unordered_map<std::string, std::string> devices;
+    // Start the controller (spawns a UDP listener in its own thread).
+    void start();
 
-    // cues fired count
-    std::unordered_map<std::string, int> cueFiredCount;
-    std::mutex dotsMutex;
-    bool dots_on = false;  // Shared flag to control command sending.
-    RandomizedSender* dotsBS1 = nullptr;
-    RandomizedSender* dotsBS2 = nullptr;
+    // Runs the startup cues without a listener or readiness wait; messages
+    // are then fed in with injectMessage(). Used by the replay tool.
+    void startOffline();
+    void injectMessage(const std::string &msg, const sockaddr_in &src) {
+        processIncomingMessage(msg, src, sizeof(src));
+    }
+    // Runs the timers due by t; for the replay tool, under TimerWheel virtual time.
+    void advanceTo(TimerWheel::Clock::time_point t) { scheduler.advanceTo(t); }
+    // Timers not yet fired (delayed actions, generator waits, timelines).
+    uint64_t pendingTimers() { return scheduler.stats().pending; }
 
-    // Cue definitions (each cue is a JSON object).
-    std::vector<json> cues;
+    // The STATS reply: timer lateness, action timing histogram, startup summary.
+    std::string statsReport();
 
+private:
+    // UdpComm instance dedicated to controller operations.
+    UdpComm *udp;
 
+    // Current devices and cues. Read with std::atomic_load and replaced with
+    // std::atomic_store; readers keep the table they loaded alive.
+    std::shared_ptr<const CueTable> table;
 
+    std::mutex configureMutex;    // Held across build, inherit and publish in configure().
 
-    // Start the controller (spawns a UDP listener in its own thread).
-    void start();
+    // Ambient clip generators, rebuilt with the table; swapped like it.
+    std::shared_ptr<const GeneratorSet> generators;
+    json generatorConfig;         // The "generators" array from the last configure().
+    bool generatorsLive = false;  // Set once the startup cues have run.
+    uint32_t generatorBuilds = 0; // Sets built so far; each gets its own seed.
+    std::mutex generatorMutex;    // Guards the three above and serialises startGenerators().
 
-private:
-    // UdpComm instance dedicated to controller operations.
-    UdpComm *udp;
+    // Runs reload() off the listener; stopped first in the destructor.
+    ReloadQueue reloads;
+
+    // Cues matched by the message being handled; listener thread only.
+    std::vector<uint32_t> matchedCues;
+
+    // Readiness: devices that answered STATUS (or sent READY), with the time
+    // since start() when they did. Guarded by readyMutex.
+    std::chrono::steady_clock::time_point startedAt;
+    std::unordered_map<std::string, long long> readyAfterMs;
+    std::string startupReport;  // Summary line for STATS, set once the barrier is passed.
+    std::mutex readyMutex;
+    std::condition_variable readyChanged;
+
+    // Probes the required devices until they are all ready or the timeout expires.
+    void waitForDevices();
+    // The devices waited for when "startup" names none: see the README.
+    std::vector<std::string> defaultRequiredDevices(const CueTable &current);
+    // Records readiness and boot-to-first-frame from a device's message.
+    void noteDeviceMessage(const std::string &senderName, const std::string &msg);
 
     // run the startup commands specified in the json
     void processStartupComplete();
+    // Replaces the running generators with ones built from generatorConfig.
+    // Does nothing until it has been called atStartup.
+    void startGenerators(bool atStartup);
+
+    // Cue and action delays run as timers on one scheduler thread, so the
+    // thread count does not grow with the number of cues in flight.
+    TimerWheel scheduler;
+
+    // Runs a compiled cue at its trigger time plus its delay: straight away
+    // when there is no delay, otherwise as a timer.
+    void fireCue(std::shared_ptr<const CueTable> current, uint32_t cueIndex);
+    // Sends or schedules the cue's actions (or alternates) from cueTime.
+    void runCue(std::shared_ptr<const CueTable> current, uint32_t cueIndex, uint32_t count,
+                TimerWheel::Clock::time_point cueTime, bool useAlternate);
+    // Sends one action to each of its destinations.
+    void sendAction(const CueTable &table, const CompiledAction &action);
+    // Sends actions [first, first + count) whose conditions hold immediately,
+    // ignoring their delays. fired is the cue's firing number.
+    void runActions(const CueTable &table, uint32_t first, uint32_t count, uint32_t fired);
+    // Timelines by name, created on first START and kept across reloads.
+    std::unordered_map<std::string, std::shared_ptr<Timeline>> timelines;
+    std::mutex timelineMutex;
+
+    // Runs "START|PAUSE|RESUME|STOP|STATUS <name>" or "SEEK <name> <ms>" and
+    // returns the timeline's status line, or an error.
+    std::string timelineCommand(const std::string &command);
+
+    // Timing error of each cue action against its authored deadline.
+    Histogram actionError;
+    // Time to put one action's datagrams on the wire, for actions with more
+    // than one destination.
+    Histogram fanoutTime;
+
+    // Sends actions [first, end) at cueTime plus each action's offset. Actions
+    // already due are sent straight away on the calling thread (the listener
+    // for a cue without delay, else the scheduler); the rest become timers.
+    void scheduleActions(std::shared_ptr<const CueTable> current, uint32_t first, uint32_t end,
+                         uint32_t count, TimerWheel::Clock::time_point cueTime);
+    // Sends one action if its condition holds (count is the cue's firing
+    // number) and records how far it was from its deadline.
+    void sendActionAt(const CueTable &table, uint32_t index, uint32_t count,
+                      TimerWheel::Clock::time_point deadline);
 
     // Process an incoming UDP message.
     void processIncomingMessage(const std::string &msg, const sockaddr_in &src, socklen_t srcLen);
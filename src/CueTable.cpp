@@ -0,0 +1,459 @@
+#include "CueTable.h"
+#include <algorithm>
+#include <iostream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+// Returns the id of s in ids, adding it if new.
+static uint32_t intern(std::unordered_map<std::string, uint32_t> &ids, const std::string &s) {
+    auto it = ids.find(s);
+    if (it != ids.end())
+        return it->second;
+    uint32_t id = static_cast<uint32_t>(ids.size());
+    ids.emplace(s, id);
+    return id;
+}
+
+void CueTable::match(bool timePos, const std::string &key, uint32_t senderId, std::vector<uint32_t> &cues) const {
+    // Reused between calls so matching does not allocate once warmed up.
+    thread_local std::vector<uint32_t> hits;
+    hits.clear();
+    (timePos ? labelMatcher : messageMatcher).match(key, hits);
+    size_t start = cues.size();
+    for (uint32_t pattern : hits) {
+        for (uint32_t device : {senderId, ANY_DEVICE}) {
+            if (device == NO_DEVICE)
+                continue;
+            auto it = triggerIndex.find(triggerKey(timePos, pattern, device));
+            if (it != triggerIndex.end())
+                cues.insert(cues.end(), it->second.begin(), it->second.end());
+        }
+    }
+    std::sort(cues.begin() + start, cues.end());
+}
+
+bool CueTable::conditionHolds(uint32_t condition, uint32_t count) const {
+    if (condition == NO_CONDITION)
+        return true;
+    ConditionContext ctx;
+    ctx.devices = deviceStates.get();
+    ctx.count = count;
+    ctx.nowMs = DeviceState::clockMs();
+    return conditions[condition].evaluate(ctx);
+}
+
+void CueTable::inheritDeviceStates(const CueTable &old) const {
+    for (uint32_t id = 0; id < deviceNames.size(); id++) {
+        auto it = old.deviceIds.find(deviceNames[id]);
+        if (it != old.deviceIds.end() && it->second < old.deviceNames.size())
+            deviceStates[id].copyFrom(old.deviceStates[it->second]);
+    }
+}
+
+uint32_t CueTable::identifySender(uint32_t addr, uint16_t port) const {
+    auto it = senderIndex.find(senderKey(addr, port));
+    if (it == senderIndex.end())
+        it = senderIndex.find(senderKey(addr, 0));
+    return it == senderIndex.end() ? unknownSenderId : it->second;
+}
+
+size_t CueTable::compiledBytes() const {
+    size_t bytes = cues.capacity() * sizeof(CompiledCue) +
+                   actions.capacity() * sizeof(CompiledAction) +
+                   destinations.capacity() * sizeof(uint32_t) +
+                   endpoints.capacity() * sizeof(sockaddr_in);
+    for (const auto &m : messages)
+        bytes += sizeof(std::string) + m.capacity();
+    for (const auto &n : cueNames)
+        bytes += sizeof(std::string) + n.capacity();
+    for (const auto &c : conditions)
+        bytes += sizeof(Condition) + c.codeBytes();
+    return bytes;
+}
+
+uint32_t CueTable::addCondition(const std::string &source) {
+    conditions.push_back(Condition::compile(source, deviceIds));
+    return static_cast<uint32_t>(conditions.size() - 1);
+}
+
+uint32_t CueTable::compileActions(const json &list, std::unordered_map<std::string, uint32_t> &messageIndex,
+                                  uint32_t &count, bool timeline) {
+    uint32_t first = static_cast<uint32_t>(actions.size());
+    uint32_t offset = 0;
+    count = 0;
+    if (!list.is_array())
+        return first;
+    for (const auto &action : list) {
+        std::string type = action.value("type", timeline ? "send_udp" : "");
+        if (type != "send_udp" && type != "timeline")
+            continue;
+        CompiledAction compiled{};
+        std::string message = action.value("message", "");
+        // Timeline control runs in the controller: the message is the command,
+        // e.g. "SEEK show 90000", and there are no destinations.
+        compiled.control = type == "timeline";
+        if (compiled.control) {
+            message = action.value("command", "START") + " " + action.value("timeline", "");
+            if (action.contains("position_ms"))
+                message += " " + std::to_string(action["position_ms"].get<long long>());
+        }
+        auto it = messageIndex.find(message);
+        if (it == messageIndex.end()) {
+            it = messageIndex.emplace(message, static_cast<uint32_t>(messages.size())).first;
+            messages.push_back(message);
+        }
+        compiled.messageId = it->second;
+        // delay_ms is authored relative to the previous action; store the offset
+        // from the cue so sending time never accumulates as drift. Timeline
+        // entries give their offset directly as at_ms. An action dropped for a
+        // bad condition below still counts, so later ones keep their times.
+        if (timeline)
+            offset = static_cast<uint32_t>(std::max(0, action.value("at_ms", 0)));
+        else
+            offset += static_cast<uint32_t>(std::max(0, action.value("delay_ms", 0)));
+        compiled.condition = NO_CONDITION;
+        if (action.contains("condition")) {
+            try {
+                compiled.condition = addCondition(action["condition"].get<std::string>());
+            } catch (const Condition::Error &e) {
+                std::cout << "Action " << message << ": bad condition (" << e.what() << "), action ignored"
+                          << std::endl;
+                continue;
+            }
+        }
+        compiled.offsetTicks = offset;
+        compiled.firstDestination = static_cast<uint32_t>(destinations.size());
+        // Groups and globs are expanded and unknown destinations dropped here,
+        // so a send walks one contiguous endpoint range. A device named twice
+        // gets the message once.
+        if (action.contains("destination") && action["destination"].is_array()) {
+            std::vector<uint32_t> ids;
+            for (const auto &dest : action["destination"])
+                if (dest.is_string())
+                    resolveDestination(dest.get<std::string>(), ids);
+            std::unordered_set<uint32_t> seen;
+            for (uint32_t id : ids) {
+                if (!seen.insert(id).second)
+                    continue;
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(static_cast<uint16_t>(devicePorts[id] ? devicePorts[id] : defaultPort));
+                addr.sin_addr.s_addr = inet_addr(deviceIps[id].c_str());
+                destinations.push_back(id);
+                endpoints.push_back(addr);
+            }
+        }
+        compiled.destinationCount = static_cast<uint32_t>(destinations.size()) - compiled.firstDestination;
+        actions.push_back(compiled);
+        count++;
+    }
+    return first;
+}
+
+void CueTable::resolveDestination(const std::string &name, std::vector<uint32_t> &ids) const {
+    auto group = groups.find(name);
+    if (group != groups.end()) {
+        ids.insert(ids.end(), group->second.begin(), group->second.end());
+        return;
+    }
+    if (name.find_first_of("*?") != std::string::npos) {
+        for (uint32_t id = 0; id < configuredDevices; id++)
+            if (TriggerMatcher::globMatch(name.c_str(), deviceNames[id].c_str()))
+                ids.push_back(id);
+        return;
+    }
+    auto device = deviceIds.find(name);
+    if (device != deviceIds.end() && device->second < configuredDevices)
+        ids.push_back(device->second);
+}
+
+void CueTable::expandGroup(const json &config, const std::string &name, std::vector<std::string> &visiting) {
+    if (groups.count(name) || !config[name].is_array())
+        return;
+    if (std::find(visiting.begin(), visiting.end(), name) != visiting.end()) {
+        std::cout << "Group " << name << " contains itself, cycle ignored" << std::endl;
+        return;
+    }
+    visiting.push_back(name);
+    std::vector<uint32_t> ids;
+    for (const auto &member : config[name]) {
+        if (!member.is_string())
+            continue;
+        std::string m = member.get<std::string>();
+        if (config.contains(m) && !deviceIds.count(m)) {
+            expandGroup(config, m, visiting);
+            auto it = groups.find(m);
+            if (it != groups.end())
+                ids.insert(ids.end(), it->second.begin(), it->second.end());
+        } else {
+            resolveDestination(m, ids);
+        }
+    }
+    visiting.pop_back();
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    groups[name] = std::move(ids);
+}
+
+CueTable::Admission CueTable::admitFiring(uint32_t cueIndex, int64_t nowMs) const {
+    const CompiledCue &cue = cues[cueIndex];
+    if (!cue.guarded)
+        return ADMITTED;
+    CueGuard &guard = guards[cueIndex];
+    int64_t end = guard.windowEndsMs.load(std::memory_order_relaxed);
+    int64_t last = guard.lastAcceptedMs.load(std::memory_order_relaxed);
+    uint32_t pending = guard.pending.load(std::memory_order_relaxed);
+    auto coalesced = [&] { return cue.coalesceTicks && nowMs < end; };
+    auto tooSoon = [&] {
+        return cue.minIntervalTicks && last != INT64_MIN && nowMs - last < cue.minIntervalTicks;
+    };
+    auto tooMany = [&] { return cue.maxPending && pending >= cue.maxPending; };
+
+    // Every limit is checked before any is claimed, so a trigger refused by
+    // one leaves the others untouched. The claims are compare-and-swaps, so
+    // concurrent duplicates cannot both pass; one lost to a concurrent
+    // trigger gives back the claims made before it.
+    Admission refusal = coalesced() ? COALESCED : tooSoon() ? TOO_SOON : tooMany() ? TOO_MANY_PENDING : ADMITTED;
+    bool claimedPending = false;
+    bool claimedLast = false;
+    if (!refusal && cue.maxPending) {
+        do {
+            if (tooMany()) {
+                refusal = TOO_MANY_PENDING;
+                break;
+            }
+        } while (!guard.pending.compare_exchange_weak(pending, pending + 1, std::memory_order_relaxed));
+        claimedPending = !refusal;
+    }
+    if (!refusal && cue.minIntervalTicks) {
+        do {
+            if (tooSoon()) {
+                refusal = TOO_SOON;
+                break;
+            }
+        } while (!guard.lastAcceptedMs.compare_exchange_weak(last, nowMs, std::memory_order_relaxed));
+        claimedLast = !refusal;
+    }
+    if (!refusal && cue.coalesceTicks) {
+        do {
+            if (coalesced()) {
+                refusal = COALESCED;
+                break;
+            }
+        } while (!guard.windowEndsMs.compare_exchange_weak(end, nowMs + cue.coalesceTicks,
+                                                           std::memory_order_relaxed));
+    }
+    if (!refusal) {
+        guard.reported.store(false, std::memory_order_relaxed);
+        return ADMITTED;
+    }
+    if (claimedLast) {
+        int64_t mine = nowMs;
+        guard.lastAcceptedMs.compare_exchange_strong(mine, last, std::memory_order_relaxed);
+    }
+    if (claimedPending)
+        guard.pending.fetch_sub(1, std::memory_order_relaxed);
+    guard.suppressed.fetch_add(1, std::memory_order_relaxed);
+    suppressedTotals[refusal].fetch_add(1, std::memory_order_relaxed);
+    return refusal;
+}
+
+bool CueTable::countFiring(uint32_t cueIndex) const {
+    const CompiledCue &cue = cues[cueIndex];
+    if (!cue.hasAlternates)
+        return false;
+    std::atomic<uint32_t> &count = fireCounts[cueIndex];
+    uint32_t seen = count.load(std::memory_order_relaxed);
+    uint32_t next;
+    do {
+        next = seen + 1 >= cue.countRequirement ? 0 : seen + 1;
+    } while (!count.compare_exchange_weak(seen, next, std::memory_order_relaxed));
+    return next == 0;
+}
+
+std::shared_ptr<const CueTable> CueTable::build(const json &config, int defaultPort) {
+    auto table = std::make_shared<CueTable>();
+    table->defaultPort = defaultPort;
+
+    // Populate the devices.
+    if (config.contains("devices")) {
+        std::cout << "Configuring devices:" << std::endl;
+        for (auto &item : config["devices"].items()) {
+            std::string name = item.key();
+            std::string ip = item.value()["ip"].get<std::string>();
+            int port = item.value().value("port", 0);
+            table->devicePlayer.push_back(item.value().contains("player")
+                                              ? static_cast<int8_t>(item.value()["player"].get<bool>()) : -1);
+            table->devices[name] = ip;
+            uint32_t id = intern(table->deviceIds, name);
+            table->deviceNames.push_back(name);
+            table->deviceIps.push_back(ip);
+            table->devicePorts.push_back(port);
+            in_addr addr{};
+            if (inet_pton(AF_INET, ip.c_str(), &addr) == 1)
+                table->senderIndex[senderKey(addr.s_addr, htons(static_cast<uint16_t>(port)))] = id;
+            std::cout << "  Added device: " << name << " with IP: " << ip
+                      << (port ? ":" + std::to_string(port) : "") << std::endl;
+        }
+    }
+    std::cout << "Total devices configured: " << table->devices.size() << std::endl;
+    const uint32_t configuredDevices = static_cast<uint32_t>(table->deviceNames.size());
+    table->configuredDevices = configuredDevices;
+
+    // Groups: { "wall-A": ["wall-A/*"], "walls": ["wall-A", "wall-B", "P1"] }
+    if (config.contains("groups") && config["groups"].is_object()) {
+        const json &groups = config["groups"];
+        for (auto &item : groups.items()) {
+            if (!item.value().is_array())
+                continue;
+            std::vector<std::string> visiting;
+            table->expandGroup(groups, item.key(), visiting);
+        }
+        for (auto &group : table->groups)
+            std::cout << "  Group " << group.first << ": " << group.second.size() << " devices" << std::endl;
+    }
+
+    // Compile the cues.
+    static const json noCues = json::array();
+    const json &cues = config.contains("cues") && config["cues"].is_array() ? config["cues"] : noCues;
+    std::cout << "Loading " << cues.size() << " cues" << std::endl;
+
+    std::unordered_map<std::string, uint32_t> messageIndex;
+    for (const auto &cue : cues) {
+        if (!cue.contains("trigger") || !cue["trigger"].contains("type"))
+            continue;
+        const json &trigger = cue["trigger"];
+
+        // The cue is validated before its name and actions are added, so a
+        // dropped cue leaves nothing behind in the table.
+        std::string name = cue.value("name", "");
+        bool startup = trigger["type"] == "startup_complete";
+        bool timePos = trigger["type"] == "time_pos";
+        bool matched = timePos || trigger["type"] == "udp_message";
+        TriggerMatcher::Kind kind{};
+        if (matched && !TriggerMatcher::parseKind(trigger.value("match", ""), kind)) {
+            std::cout << "Cue " << name << ": unknown match type " << trigger["match"] << ", cue ignored"
+                      << std::endl;
+            continue;
+        }
+        CompiledCue compiled{};
+        compiled.condition = NO_CONDITION;
+        if (cue.contains("condition")) {
+            try {
+                compiled.condition = table->addCondition(cue["condition"].get<std::string>());
+            } catch (const Condition::Error &e) {
+                std::cout << "Cue " << name << ": bad condition (" << e.what() << "), cue ignored" << std::endl;
+                continue;
+            }
+        }
+        uint32_t patternId = 0;
+        if (matched) {
+            try {
+                patternId = timePos ? table->labelMatcher.add(kind, trigger.value("label", ""))
+                                    : table->messageMatcher.add(kind, trigger.value("message", ""));
+            } catch (const std::regex_error &e) {
+                std::cout << "Cue " << name << ": bad regex (" << e.what() << "), cue ignored" << std::endl;
+                continue;
+            }
+        }
+
+        compiled.nameId = static_cast<uint32_t>(table->cueNames.size());
+        table->cueNames.push_back(name);
+        compiled.delayTicks = static_cast<uint32_t>(std::max(0, trigger.value("delay_ms", 0)));
+        compiled.countRequirement = static_cast<uint32_t>(std::max(1, trigger.value("count", 1)));
+        compiled.firstAction = table->compileActions(cue.value("actions", json::array()), messageIndex,
+                                                     compiled.actionCount);
+        compiled.hasAlternates = cue.contains("alternate_actions") && cue["alternate_actions"].is_array();
+        compiled.firstAlternate = table->compileActions(cue.value("alternate_actions", json::array()), messageIndex,
+                                                        compiled.alternateCount);
+        // Offsets are cumulative, so each list's last action is its latest.
+        if (compiled.actionCount)
+            compiled.spanTicks = table->actions[compiled.firstAction + compiled.actionCount - 1].offsetTicks;
+        if (compiled.alternateCount)
+            compiled.spanTicks = std::max(compiled.spanTicks,
+                table->actions[compiled.firstAlternate + compiled.alternateCount - 1].offsetTicks);
+        compiled.minIntervalTicks = static_cast<uint32_t>(std::max(0, trigger.value("min_interval_ms", 0)));
+        compiled.maxPending = static_cast<uint32_t>(std::max(0, trigger.value("max_pending", 0)));
+        compiled.coalesceTicks = static_cast<uint32_t>(std::max(0, trigger.value("coalesce_ms", 0)));
+        compiled.guarded = compiled.minIntervalTicks || compiled.maxPending || compiled.coalesceTicks;
+        uint32_t index = static_cast<uint32_t>(table->cues.size());
+        table->cues.push_back(compiled);
+
+        // Index the trigger.
+        if (startup) {
+            table->startupCues.push_back(index);
+            continue;
+        }
+        if (!matched)
+            continue;
+
+        // from_device is a device name, "*" for any sender, or a glob over the
+        // configured device names expanded here.
+        std::string from = trigger.value("from_device", "");
+        std::vector<uint32_t> deviceIds;
+        if (from == "*") {
+            deviceIds.push_back(ANY_DEVICE);
+        } else if (from.find_first_of("*?") != std::string::npos) {
+            for (uint32_t id = 0; id < configuredDevices; id++)
+                if (TriggerMatcher::globMatch(from.c_str(), table->deviceNames[id].c_str()))
+                    deviceIds.push_back(id);
+        } else {
+            uint32_t deviceId = intern(table->deviceIds, from);
+            if (deviceId >= table->deviceNames.size()) {
+                table->deviceNames.push_back(from);
+                table->deviceIps.emplace_back();
+                table->devicePorts.push_back(0);
+            }
+            deviceIds.push_back(deviceId);
+        }
+        for (uint32_t deviceId : deviceIds) {
+            table->triggerIndex[triggerKey(timePos, patternId, deviceId)].push_back(index);
+            if (deviceId == ANY_DEVICE)
+                continue;
+            if (deviceId >= table->deviceHeardFrom.size())
+                table->deviceHeardFrom.resize(deviceId + 1, 0);
+            table->deviceHeardFrom[deviceId] = 1;
+        }
+    }
+
+    // Timelines: { "name": "show", "entries": [{ "at_ms": 0, "message": ..., "destination": [...] }] }
+    if (config.contains("timelines") && config["timelines"].is_array()) {
+        for (const auto &t : config["timelines"]) {
+            CompiledTimeline compiled{};
+            std::string name = t.value("name", "");
+            compiled.firstAction = table->compileActions(t.value("entries", json::array()), messageIndex,
+                                                         compiled.actionCount, true);
+            // Entries run in time order whatever order they were written in.
+            std::stable_sort(table->actions.begin() + compiled.firstAction, table->actions.end(),
+                             [](const CompiledAction &a, const CompiledAction &b) {
+                                 return a.offsetTicks < b.offsetTicks;
+                             });
+            table->timelineIds[name] = static_cast<uint32_t>(table->timelines.size());
+            table->timelines.push_back(compiled);
+            std::cout << "Loaded timeline " << name << " with " << compiled.actionCount << " entries" << std::endl;
+        }
+    }
+
+    table->fireCounts.reset(new std::atomic<uint32_t>[table->cues.size()]());
+    table->totalFires.reset(new std::atomic<uint32_t>[table->cues.size()]());
+    table->guards.reset(new CueGuard[table->cues.size()]);
+    table->deviceStates.reset(new DeviceState[table->deviceNames.size()]);
+
+    // Senders that match no device are reported as "Unknown", which triggers may name.
+    auto unknown = table->deviceIds.find("Unknown");
+    if (unknown != table->deviceIds.end())
+        table->unknownSenderId = unknown->second;
+
+    size_t bytes = table->compiledBytes();
+    std::cout << "Compiled " << table->cues.size() << " cues into " << bytes << " bytes ("
+              << (table->cues.empty() ? 0 : bytes / table->cues.size()) << " bytes per cue, "
+              << cues.dump().size() << " bytes of JSON)" << std::endl;
+    return table;
+}
@@ -0,0 +1,210 @@
+#ifndef CUETABLE_H
+#define CUETABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "json.hpp"
+#include "TriggerMatcher.h"
+#include "Condition.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+
+using json = nlohmann::json;
+
+// A send_udp action. Delays are in ticks of 1 ms.
+struct CompiledAction {
+    uint32_t messageId;         // Index into CueTable::messages.
+    uint32_t firstDestination;  // Range in CueTable::destinations.
+    uint32_t destinationCount;
+    uint32_t offsetTicks;       // Send time after the cue fires: the running sum of delay_ms.
+    uint32_t condition;         // Index into CueTable::conditions, or NO_CONDITION.
+    bool control;               // A timeline command handled by the controller, not sent.
+};
+
+// A cue reduced to ids and ranges; firing it never touches json.
+struct CompiledCue {
+    uint32_t nameId;            // Index into CueTable::cueNames.
+    uint32_t delayTicks;        // Trigger delay.
+    uint32_t countRequirement;  // Every count-th firing uses the alternate actions.
+    uint32_t firstAction;       // Range in CueTable::actions.
+    uint32_t actionCount;
+    uint32_t firstAlternate;    // Range in CueTable::actions.
+    uint32_t alternateCount;
+    bool hasAlternates;
+    uint32_t condition;         // Index into CueTable::conditions, or NO_CONDITION.
+    // Storm protection, 0 = off. See CueTable::admitFiring.
+    uint32_t minIntervalTicks;
+    uint32_t maxPending;
+    uint32_t coalesceTicks;
+    uint32_t spanTicks;         // Offset of the cue's last action, normal or alternate.
+    bool guarded;               // Any of the three set.
+};
+
+static constexpr uint32_t NO_CONDITION = UINT32_MAX;
+
+// Per-cue admission state, all atomics so admitting a trigger takes no lock.
+struct CueGuard {
+    std::atomic<int64_t> lastAcceptedMs{INT64_MIN};
+    std::atomic<int64_t> windowEndsMs{INT64_MIN};
+    std::atomic<uint32_t> pending{0};
+    std::atomic<uint32_t> suppressed{0};
+    std::atomic<bool> reported{false};  // A suppression since the last accepted firing was logged.
+};
+
+// Timeline entries are actions whose offsets are their at_ms, sorted by time.
+struct CompiledTimeline {
+    uint32_t firstAction;       // Range in CueTable::actions.
+    uint32_t actionCount;
+};
+
+// Devices and cues loaded from the config. A table is never modified after it
+// is built: a reload builds a new one and the Controller swaps the pointer, so
+// delayed actions that hold the old table keep running against it.
+struct CueTable {
+    // Map of device names to their IP addresses.
+    std::unordered_map<std::string, std::string> devices;
+
+    // Device ids share one space: configured devices first, then names that
+    // only appear as from_device. The vectors are indexed by id; deviceIps is
+    // "" and devicePorts 0 for names without a configured device.
+    static constexpr uint32_t NO_DEVICE = UINT32_MAX;
+    std::unordered_map<std::string, uint32_t> deviceIds;
+    std::vector<std::string> deviceNames;
+    std::vector<std::string> deviceIps;
+    std::vector<int> devicePorts;  // Optional per-device command port, 0 = controller default.
+    uint32_t configuredDevices = 0;
+    // Per configured device: its "player" key, 1 or 0, or -1 when it has none.
+    std::vector<int8_t> devicePlayer;
+    // Per device id: named (not by "*") in some trigger's from_device, so it
+    // talks to the controller.
+    std::vector<char> deviceHeardFrom;
+    int defaultPort = 0;           // Command port of devices without their own.
+
+    // Device groups from the "groups" section, expanded at load time into
+    // device ids. Members are device names, other groups or globs over device
+    // names such as "wall-A/*".
+    std::unordered_map<std::string, std::vector<uint32_t>> groups;
+
+    // Devices by binary address: key is (s_addr << 16 | port), with port 0 for
+    // devices that match any source port.
+    std::unordered_map<uint64_t, uint32_t> senderIndex;
+    uint32_t unknownSenderId = NO_DEVICE;  // Id of "Unknown" if a trigger names it.
+
+    static uint64_t senderKey(uint32_t addr, uint16_t port) {
+        return (static_cast<uint64_t>(addr) << 16) | port;
+    }
+    // Device id of a sender (address and port in network byte order), or unknownSenderId.
+    uint32_t identifySender(uint32_t addr, uint16_t port) const;
+
+    // Compiled cues and the flat arrays they point into.
+    std::vector<CompiledCue> cues;
+    std::vector<CompiledAction> actions;
+    std::vector<uint32_t> destinations;      // Device ids.
+    std::vector<sockaddr_in> endpoints;      // Parallel to destinations; an action's range is one batch.
+    std::vector<std::string> messages;       // Interned action messages.
+    std::vector<std::string> cueNames;
+    std::vector<uint32_t> startupCues;       // Cues with a startup_complete trigger.
+    std::vector<CompiledTimeline> timelines;
+    std::unordered_map<std::string, uint32_t> timelineIds;
+
+    // Conditions of cues and actions, compiled at load time.
+    std::vector<Condition> conditions;
+
+    // The only mutable state in a table, all atomics. Per cue: firings since
+    // the last alternate and firings in total; a reload starts them from zero.
+    std::unique_ptr<std::atomic<uint32_t>[]> fireCounts;
+    std::unique_ptr<std::atomic<uint32_t>[]> totalFires;
+    // Per device id; carried over by name on reload with inheritDeviceStates().
+    std::unique_ptr<DeviceState[]> deviceStates;
+    // Per cue; like the counters, restarts on reload.
+    std::unique_ptr<CueGuard[]> guards;
+
+    // Why admitFiring refused a trigger.
+    enum Admission : uint32_t { ADMITTED, COALESCED, TOO_SOON, TOO_MANY_PENDING };
+    // Suppressed triggers of all cues, indexed by Admission.
+    mutable std::atomic<uint64_t> suppressedTotals[4] = {};
+
+    // Decides in O(1) whether a trigger of the cue may fire, at nowMs on the
+    // steady clock, from the cue's trigger settings:
+    //   coalesce_ms:     the first trigger opens a window; the cue fires once
+    //                    when it closes and triggers inside it are absorbed.
+    //   min_interval_ms: triggers sooner than this after the last admitted
+    //                    firing are dropped.
+    //   max_pending:     triggers are dropped while this many firings still
+    //                    have actions waiting; releaseFiring ends one.
+    // A trigger refused by one limit does not count against the others.
+    // Refusals are counted per cue and in suppressedTotals.
+    Admission admitFiring(uint32_t cueIndex, int64_t nowMs) const;
+    void releaseFiring(uint32_t cueIndex) const {
+        if (cues[cueIndex].maxPending)
+            guards[cueIndex].pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Counts a trigger of the cue and returns its firing number (the
+    // condition's "count"), whether or not its condition then holds.
+    uint32_t recordFiring(uint32_t cueIndex) const {
+        return totalFires[cueIndex].fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    // True for NO_CONDITION, otherwise the condition evaluated now.
+    bool conditionHolds(uint32_t condition, uint32_t count) const;
+    // Copies the state of devices with the same name from an older table.
+    void inheritDeviceStates(const CueTable &old) const;
+
+    // Counts a firing of the cue and returns true when it should run its
+    // alternate actions. The rule, applied as one compare-and-swap so
+    // concurrent firings never share or skip a count: the counter is
+    // incremented, and when it reaches countRequirement it is reset to zero
+    // and that firing takes the alternates. With count = 3 the firings go
+    // normal, normal, alternate, normal, ... The decision is made when the
+    // trigger arrives, not after the cue's delay.
+    bool countFiring(uint32_t cueIndex) const;
+
+    // Trigger patterns compiled at load time: udp_message triggers match the
+    // message, time_pos triggers the watch point label.
+    TriggerMatcher messageMatcher;
+    TriggerMatcher labelMatcher;
+
+    // from_device "*" accepts any sender, including unknown ones.
+    static constexpr uint32_t ANY_DEVICE = UINT32_MAX - 1;
+
+    // Indices into cues, keyed by triggerKey(timePos, pattern id, device id).
+    std::unordered_map<uint64_t, std::vector<uint32_t>> triggerIndex;
+
+    // Appends to cues, in config order, the cues triggered by a message (or,
+    // with timePos, a watch point label) from the sender. The patterns are
+    // matched in one pass; a message no pattern matches costs one trie walk.
+    void match(bool timePos, const std::string &key, uint32_t senderId, std::vector<uint32_t> &cues) const;
+
+    // Bytes held by the compiled cue model (cues, actions, destinations, strings).
+    size_t compiledBytes() const;
+
+    // Devices without a port of their own are sent to on defaultPort.
+    static std::shared_ptr<const CueTable> build(const json &config, int defaultPort);
+
+private:
+    static uint64_t triggerKey(bool timePos, uint32_t keyId, uint32_t deviceId) {
+        return (static_cast<uint64_t>(timePos) << 63) | (static_cast<uint64_t>(keyId) << 32) | deviceId;
+    }
+    // Appends the send_udp and timeline actions of a json array; returns the
+    // first index. Timeline entries take their offset from at_ms.
+    uint32_t compileActions(const json &list, std::unordered_map<std::string, uint32_t> &messageIndex,
+                            uint32_t &count, bool timeline = false);
+    // Compiles a condition against the devices; returns its index. Throws Condition::Error.
+    uint32_t addCondition(const std::string &source);
+    // Appends the configured devices a destination names: a device, a group
+    // or a glob over device names.
+    void resolveDestination(const std::string &name, std::vector<uint32_t> &ids) const;
+    // Expands groups[name] from its config members, recursing into groups it names.
+    void expandGroup(const json &config, const std::string &name, std::vector<std::string> &visiting);
+};
+
+#endif // CUETABLE_H
@@ -0,0 +1,65 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <cstdio>
+
+void Histogram::record(double ms) {
+    uint64_t us = ms > 0 ? static_cast<uint64_t>(ms * 1000.0) : 0;
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && us >= (1ull << bucket))
+        bucket++;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = maxUs.load(std::memory_order_relaxed);
+    while (us > seen && !maxUs.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::reset() {
+    for (auto &b : buckets)
+        b.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    maxUs.store(0, std::memory_order_relaxed);
+}
+
+double Histogram::bucketUpperMs(int bucket) {
+    return static_cast<double>(1ull << bucket) / 1000.0;
+}
+
+double Histogram::percentileMs(double p) const {
+    uint64_t n = count();
+    if (n == 0)
+        return 0.0;
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(n));
+    if (rank >= n)
+        rank = n - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS - 1; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return std::min(bucketUpperMs(i), maxMs());
+    }
+    return maxMs();
+}
+
+std::string Histogram::summary() const {
+    char head[128];
+    snprintf(head, sizeof(head), "n=%llu p50_ms=%.3f p99_ms=%.3f max_ms=%.3f buckets_us=",
+             static_cast<unsigned long long>(count()), percentileMs(50), percentileMs(99), maxMs());
+    std::string out = head;
+    bool first = true;
+    for (int i = 0; i < BUCKETS; i++) {
+        uint64_t c = buckets[i].load(std::memory_order_relaxed);
+        if (c == 0)
+            continue;
+        char part[48];
+        if (i < BUCKETS - 1)
+            snprintf(part, sizeof(part), "%s<%llu:%llu", first ? "" : ",", 1ull << i,
+                     static_cast<unsigned long long>(c));
+        else
+            snprintf(part, sizeof(part), "%s>=%llu:%llu", first ? "" : ",", 1ull << (i - 1),
+                     static_cast<unsigned long long>(c));
+        out += part;
+        first = false;
+    }
+    return out;
+}
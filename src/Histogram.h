@@ -0,0 +1,35 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lock-free latency histogram with power-of-two microsecond buckets. One
+// thread may record while others read a summary.
+class Histogram {
+public:
+    // Bucket i counts values below 2^i us, up to about 4.2 s; the last bucket
+    // takes the rest. Percentiles that fall there report the exact max.
+    static constexpr int BUCKETS = 24;
+
+    void record(double ms);
+    void reset();
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    double maxMs() const { return maxUs.load(std::memory_order_relaxed) / 1000.0; }
+    // Upper bound of the bucket holding the given percentile (0-100), in ms.
+    double percentileMs(double p) const;
+
+    // "n= p50_ms= p99_ms= max_ms= buckets_us=<1:..,<2:..,..".
+    std::string summary() const;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> maxUs{0};
+
+    static double bucketUpperMs(int bucket);
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,237 @@
+#include "Journal.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[8] = {'C', 'H', 'A', 'R', 'J', 'N', 'L', '1'};
+static const uint32_t VERSION = 1;
+
+std::atomic<Journal *> Journal::activeJournal{nullptr};
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+int64_t Journal::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Journal::~Journal() {
+    close();
+}
+
+bool Journal::open(const std::string &path, size_t capacityBytes) {
+    close();
+    uint64_t capacity = align8(std::max<size_t>(capacityBytes, 64 * 1024));
+    size_t total = sizeof(Header) + capacity;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Journal: cannot open " << path << std::endl;
+        return false;
+    }
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(total);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, total) : nullptr;
+    if (!view) {
+        std::cerr << "Journal: cannot map " << path << std::endl;
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+#else
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Journal: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) != total && ftruncate(fd, total) != 0)) {
+        std::cerr << "Journal: cannot size " << path << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    void *view = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) {
+        std::cerr << "Journal: cannot map " << path << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(mutex);
+    base = static_cast<char *>(view);
+    mappedBytes = total;
+    header = reinterpret_cast<Header *>(base);
+    ring = base + sizeof(Header);
+    // A journal with another layout or size starts over.
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION ||
+        header->headerSize != sizeof(Header) || header->capacity != capacity || header->tail > header->head ||
+        header->head - header->tail > capacity) {
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = VERSION;
+        header->headerSize = sizeof(Header);
+        header->capacity = capacity;
+        header->head = 0;
+        header->tail = 0;
+    }
+    header->openedWallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    header->openedSteadyNs = nowNs();
+    return true;
+}
+
+void Journal::close() {
+    if (active() == this)
+        setActive(nullptr);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(static_cast<HANDLE>(mappingHandle));
+    CloseHandle(static_cast<HANDLE>(fileHandle));
+    mappingHandle = fileHandle = nullptr;
+#else
+    munmap(base, mappedBytes);
+    ::close(fd);
+    fd = -1;
+#endif
+    base = ring = nullptr;
+    header = nullptr;
+    mappedBytes = 0;
+}
+
+void Journal::makeRoom(uint64_t bytes) {
+    while (header->head + bytes - header->tail > header->capacity) {
+        uint64_t phys = header->tail % header->capacity;
+        uint64_t left = header->capacity - phys;
+        if (left < sizeof(Record)) {
+            header->tail += left;  // Too short for a record: implicit padding.
+            continue;
+        }
+        // The file may have been damaged on disk; a size that cannot be
+        // right would stall every append here, so the ring starts over.
+        const Record *oldest = reinterpret_cast<const Record *>(ring + phys);
+        if (oldest->size < sizeof(Record) || oldest->size > left || oldest->size % 8 != 0) {
+            std::cerr << "Journal: corrupt record at offset " << header->tail << ", dropping "
+                      << header->head - header->tail << " bytes of records" << std::endl;
+            header->tail = header->head;
+            return;
+        }
+        header->tail += oldest->size;
+    }
+}
+
+void Journal::append(Type type, uint16_t localPort, uint32_t addr, uint16_t port, const char *data, size_t length) {
+    int64_t ts = nowNs();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!header)
+        return;
+    uint64_t size = align8(sizeof(Record) + length);
+    if (size > header->capacity / 2)
+        return;  // Never let one record wipe the ring.
+
+    // Records never wrap: the end of the ring is filled first.
+    uint64_t phys = header->head % header->capacity;
+    uint64_t left = header->capacity - phys;
+    if (left < size) {
+        makeRoom(left);
+        if (left >= sizeof(Record)) {
+            Record pad{};
+            pad.size = static_cast<uint32_t>(left);
+            pad.type = PAD;
+            memcpy(ring + phys, &pad, sizeof(pad));
+        }
+        header->head += left;
+        phys = 0;
+    }
+    makeRoom(size);
+
+    Record rec{};
+    rec.size = static_cast<uint32_t>(size);
+    rec.length = static_cast<uint32_t>(length);
+    rec.type = type;
+    rec.localPort = localPort;
+    rec.addr = addr;
+    rec.port = port;
+    rec.steadyNs = ts;
+    memcpy(ring + phys, &rec, sizeof(rec));
+    if (length)
+        memcpy(ring + phys + sizeof(rec), data, length);
+    header->head += size;
+}
+
+bool Journal::read(const std::string &path, const std::function<void(const Record &, const char *payload)> &visit,
+                   bool *truncated) {
+    if (truncated)
+        *truncated = false;
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    Header h{};
+    if (!in.read(reinterpret_cast<char *>(&h), sizeof(h)) || memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        h.version != VERSION || h.headerSize != sizeof(Header) || h.capacity == 0 || h.tail > h.head ||
+        h.head - h.tail > h.capacity)
+        return false;
+    // A short file (copied while open, or cut by a full disk) still holds the
+    // records before the cut. Only the bytes actually in the file are read, so
+    // a corrupt capacity cannot make this allocate more than the file's size.
+    std::streamoff start = in.tellg();
+    in.seekg(0, std::ios::end);
+    uint64_t inFile = static_cast<uint64_t>(std::max<std::streamoff>(0, in.tellg() - start));
+    in.seekg(start);
+    std::vector<char> ring(static_cast<size_t>(std::min(h.capacity, inFile)));
+    in.read(ring.data(), static_cast<std::streamsize>(ring.size()));
+    uint64_t available = static_cast<uint64_t>(in.gcount());
+    bool torn = false;
+
+    for (uint64_t pos = h.tail; pos < h.head;) {
+        uint64_t phys = pos % h.capacity;
+        uint64_t left = h.capacity - phys;
+        if (left < sizeof(Record)) {
+            pos += left;
+            continue;
+        }
+        if (phys + sizeof(Record) > available) {
+            torn = true;
+            break;
+        }
+        Record rec;
+        memcpy(&rec, ring.data() + phys, sizeof(rec));
+        if (rec.size < sizeof(Record) || rec.size > left || phys + rec.size > available || rec.size % 8 != 0 ||
+            (rec.type != PAD && sizeof(Record) + rec.length > rec.size)) {
+            torn = true;  // Torn write at a crash; keep what came before.
+            break;
+        }
+        if (rec.type != PAD)
+            visit(rec, ring.data() + phys + sizeof(Record));
+        pos += rec.size;
+    }
+    if (truncated)
+        *truncated = torn;
+    return true;
+}
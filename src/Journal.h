@@ -0,0 +1,96 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Fixed-size ring of binary records in a memory-mapped file. Appending is a
+// memcpy into the mapping under a short lock; the oldest records are
+// overwritten once the ring is full. The file survives a crash or restart
+// and is read back with Journal::read().
+class Journal {
+public:
+    enum Type : uint8_t {
+        SESSION = 1,  // Journal opened; payload is the process description.
+        IN = 2,       // Datagram received on localPort from addr:port.
+        OUT = 3,      // Datagram sent from localPort to addr:port.
+        CUE = 4,      // Cue fired; payload is the cue name.
+        ACTION = 5,   // Cue or timeline action sent; payload is the message.
+        PAD = 0xFF    // Filler up to the end of the ring.
+    };
+
+    // On-disk record header; the payload follows, then padding to 8 bytes.
+    struct Record {
+        uint32_t size;       // Header + payload + padding.
+        uint32_t length;     // Payload bytes.
+        uint8_t type;
+        uint8_t reserved;
+        uint16_t localPort;
+        uint32_t addr;       // Network byte order, 0 if none.
+        uint16_t port;       // Host byte order.
+        uint16_t reserved2;
+        uint32_t reserved3;
+        int64_t steadyNs;    // Monotonic timestamp.
+    };
+
+    Journal() = default;
+    ~Journal();
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    // Maps path, creating or resizing it to hold capacityBytes of records.
+    // An existing journal of the same size is appended to. Returns false on error.
+    bool open(const std::string &path, size_t capacityBytes);
+    void close();
+
+    void append(Type type, uint16_t localPort, uint32_t addr, uint16_t port, const char *data, size_t length);
+    void append(Type type, const std::string &text) { append(type, 0, 0, 0, text.data(), text.size()); }
+
+    // The journal UdpComm and the Controller write to; null when journaling is off.
+    static Journal *active() { return activeJournal.load(std::memory_order_acquire); }
+    static void setActive(Journal *journal) { activeJournal.store(journal, std::memory_order_release); }
+
+    static int64_t nowNs();
+
+    // Calls visit for every record of a journal file, oldest first. Returns
+    // false if the file is not a journal. A torn or cut-off tail ends the
+    // walk after the last complete record and sets *truncated.
+    static bool read(const std::string &path,
+                     const std::function<void(const Record &, const char *payload)> &visit,
+                     bool *truncated = nullptr);
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t capacity;   // Ring bytes after the header.
+        uint64_t head;       // Logical offset of the next record.
+        uint64_t tail;       // Logical offset of the oldest record.
+        int64_t openedWallNs;
+        int64_t openedSteadyNs;
+    };
+
+    std::mutex mutex;
+    char *base = nullptr;
+    size_t mappedBytes = 0;
+    Header *header = nullptr;
+    char *ring = nullptr;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    static std::atomic<Journal *> activeJournal;
+
+    // Drops the oldest records until `bytes` more fit. Lock held.
+    void makeRoom(uint64_t bytes);
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,260 @@
+#include "KeyframeIndex.h"
+#include <mpv/client.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+static long long fileSize(const std::string &path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        return -1;
+    return static_cast<long long>(in.tellg());
+}
+
+std::string KeyframeIndex::indexPathFor(const std::string &mediaPath) {
+    return mediaPath + ".kfidx";
+}
+
+bool KeyframeIndex::load(const std::string &mediaPath) {
+    std::ifstream in(indexPathFor(mediaPath));
+    if (!in)
+        return false;
+    try {
+        json j;
+        in >> j;
+        if (j.value("version", 0) != 1 || j.value("size", -1LL) != fileSize(mediaPath))
+            return false;
+        duration = j.value("duration", 0.0);
+        keyframes = j.value("keyframes", std::vector<double>());
+        mediaSize = j["size"].get<long long>();
+    } catch (const json::exception &) {
+        return false;
+    }
+    std::sort(keyframes.begin(), keyframes.end());
+    // An empty index (saved by older builds) says nothing; rebuild it.
+    return !keyframes.empty();
+}
+
+bool KeyframeIndex::save(const std::string &mediaPath) const {
+    std::string path = indexPathFor(mediaPath);
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp);
+        if (!out)
+            return false;
+        json j;
+        j["version"] = 1;
+        j["size"] = mediaSize;
+        j["duration"] = duration;
+        j["keyframes"] = keyframes;
+        out << j.dump();
+        out.close();
+        if (!out) {
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());  // rename does not replace an existing file here.
+#endif
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Waits for a specific event on the probe handle; false on shutdown, error or timeout.
+static bool waitFor(mpv_handle *probe, mpv_event_id id) {
+    while (true) {
+        mpv_event *event = mpv_wait_event(probe, 10.0);
+        if (event->event_id == id)
+            return true;
+        if (event->event_id == MPV_EVENT_NONE || event->event_id == MPV_EVENT_SHUTDOWN ||
+            event->event_id == MPV_EVENT_END_FILE)
+            return false;
+    }
+}
+
+bool KeyframeIndex::build(const std::string &mediaPath, double probeStep, const std::atomic<bool> &cancel,
+                          std::string &error) {
+    mediaSize = fileSize(mediaPath);
+    if (mediaSize < 0) {
+        error = "cannot open file";
+        return false;
+    }
+
+    mpv_handle *probe = mpv_create();
+    if (!probe) {
+        error = "failed to create MPV context";
+        return false;
+    }
+    // Demux and decode only the video track, with no outputs.
+    const char *options[][2] = {
+        {"vo", "null"}, {"ao", "null"}, {"aid", "no"}, {"sid", "no"},
+        {"pause", "yes"}, {"keep-open", "always"}, {"terminal", "no"},
+        {"config", "no"}, {"hwdec", "no"}, {"resume-playback", "no"},
+    };
+    for (auto &opt : options)
+        mpv_set_option_string(probe, opt[0], opt[1]);
+    int status = mpv_initialize(probe);
+    if (status < 0) {
+        error = std::string("failed to initialize MPV: ") + mpv_error_string(status);
+        mpv_terminate_destroy(probe);
+        return false;
+    }
+
+    const char *load_cmd[] = {"loadfile", mediaPath.c_str(), "replace", nullptr};
+    if (mpv_command(probe, load_cmd) < 0 || !waitFor(probe, MPV_EVENT_FILE_LOADED)) {
+        error = "failed to load file";
+        mpv_terminate_destroy(probe);
+        return false;
+    }
+    duration = 0.0;
+    mpv_get_property(probe, "duration", MPV_FORMAT_DOUBLE, &duration);
+    if (duration <= 0.0) {
+        error = "duration unavailable";
+        mpv_terminate_destroy(probe);
+        return false;
+    }
+
+    // A keyframe seek lands on a keyframe, so probing on a grid finds every
+    // keyframe spaced further apart than probeStep.
+    keyframes.clear();
+    probeStep = std::max(probeStep, MIN_PROBE_STEP);
+    for (double t = 0.0; t < duration && !cancel; t += probeStep) {
+        std::string target = std::to_string(t);
+        const char *seek_cmd[] = {"seek", target.c_str(), "absolute+keyframes", nullptr};
+        if (mpv_command(probe, seek_cmd) < 0 || !waitFor(probe, MPV_EVENT_PLAYBACK_RESTART))
+            continue;
+        double pos = -1.0;
+        if (mpv_get_property(probe, "time-pos", MPV_FORMAT_DOUBLE, &pos) >= 0 && pos >= 0.0)
+            keyframes.push_back(pos);
+    }
+    mpv_terminate_destroy(probe);
+
+    std::sort(keyframes.begin(), keyframes.end());
+    keyframes.erase(std::unique(keyframes.begin(), keyframes.end(),
+                                [](double a, double b) { return std::fabs(a - b) < 1e-3; }),
+                    keyframes.end());
+    if (cancel) {
+        error = "cancelled";
+        return false;
+    }
+    if (keyframes.empty()) {
+        error = "no keyframe found";
+        return false;
+    }
+    return true;
+}
+
+double KeyframeIndex::previousKeyframe(double t) const {
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), t);
+    if (it == keyframes.begin())
+        return 0.0;
+    return *(it - 1);
+}
+
+double KeyframeIndex::nearestKeyframe(double t) const {
+    if (keyframes.empty())
+        return t;
+    auto it = std::lower_bound(keyframes.begin(), keyframes.end(), t);
+    if (it == keyframes.end())
+        return keyframes.back();
+    if (it == keyframes.begin())
+        return *it;
+    return (*it - t) < (t - *(it - 1)) ? *it : *(it - 1);
+}
+
+KeyframeIndexCache::~KeyframeIndexCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    if (builder.joinable())
+        builder.join();
+}
+
+void KeyframeIndexCache::request(const void *owner, const std::string &filename, double probeStep, Report report) {
+    if (filename.empty())
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!requested.insert(filename).second)
+        return;
+    queue.push_back({owner, filename, probeStep, std::move(report)});
+    // Started on first use, so a process that never loads media runs no extra thread.
+    if (!builder.joinable())
+        builder = std::thread(&KeyframeIndexCache::run, this);
+    wake.notify_all();  // release() may be waiting on the same condition.
+}
+
+std::shared_ptr<const KeyframeIndex> KeyframeIndexCache::find(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = indexes.find(filename);
+    return it == indexes.end() ? nullptr : it->second;
+}
+
+void KeyframeIndexCache::release(const void *owner) {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto &job : queue)
+        if (job.owner == owner)
+            job.report = nullptr;
+    if (building.owner == owner)
+        building.report = nullptr;
+    wake.wait(lock, [&] { return reporting != owner; });
+}
+
+void KeyframeIndexCache::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            building = Job{};
+            wake.wait(lock, [this]() { return stop || !queue.empty(); });
+            if (stop)
+                return;
+            building = std::move(queue.front());
+            queue.pop_front();
+        }
+        const std::string &filename = building.filename;
+        std::vector<std::string> lines;
+        auto index = std::make_shared<KeyframeIndex>();
+        bool ready = index->load(filename);
+        if (!ready) {
+            auto started = std::chrono::steady_clock::now();
+            std::string error;
+            ready = index->build(filename, building.probeStep, stop, error);
+            if (ready) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - started).count();
+                lines.push_back("Keyframe index built for " + filename + ": " +
+                                std::to_string(index->keyframes.size()) + " keyframes in " +
+                                std::to_string(ms) + " ms");
+                if (!index->save(filename))
+                    lines.push_back("Could not save keyframe index " + KeyframeIndex::indexPathFor(filename));
+            } else if (!stop) {
+                lines.push_back("Keyframe index failed for " + filename + ": " + error);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (ready)
+            indexes[filename] = index;
+        if (lines.empty() || !building.report)
+            continue;
+        // The report runs unlocked; release() waits for it instead.
+        Report report = building.report;
+        reporting = building.owner;
+        lock.unlock();
+        for (const auto &line : lines)
+            report(line);
+        lock.lock();
+        reporting = nullptr;
+        wake.notify_all();
+    }
+}
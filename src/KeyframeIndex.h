@@ -0,0 +1,88 @@
+#ifndef KEYFRAMEINDEX_H
+#define KEYFRAMEINDEX_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Per-file keyframe positions and duration, used to pick a seek strategy.
+// The index is stored next to the media as "<file>.kfidx".
+class KeyframeIndex {
+public:
+    double duration = 0.0;
+    std::vector<double> keyframes;  // Sorted keyframe timestamps in seconds.
+
+    // Path of the index file for a media file.
+    static std::string indexPathFor(const std::string &mediaPath);
+
+    // Loads the index stored next to the media; fails if missing or stale.
+    bool load(const std::string &mediaPath);
+    // Writes a temporary file and renames it into place, so a reader never
+    // sees a half-written index.
+    bool save(const std::string &mediaPath) const;
+
+    // Smallest probe spacing; build raises smaller steps to it.
+    static constexpr double MIN_PROBE_STEP = 0.05;
+
+    // Builds the index by keyframe-seeking a private headless mpv instance
+    // through the file every probeStep seconds. Blocking; run it off the event
+    // loop. Fails without a known duration, when no keyframe is found, or once
+    // cancel is set.
+    bool build(const std::string &mediaPath, double probeStep, const std::atomic<bool> &cancel,
+               std::string &error);
+
+    // Last keyframe at or before t (0 if none).
+    double previousKeyframe(double t) const;
+    // Keyframe closest to t (t itself if the index is empty). load and build
+    // fail rather than produce an empty index.
+    double nearestKeyframe(double t) const;
+
+private:
+    long long mediaSize = -1;  // Size of the media when indexed, used to detect stale indexes.
+};
+
+// Keyframe indexes by filename, shared by all players in the process. One
+// builder thread, joined on destruction, loads or builds them one file at a
+// time, so each file is probed once however many players load it.
+class KeyframeIndexCache {
+public:
+    using Report = std::function<void(const std::string &line)>;
+
+    ~KeyframeIndexCache();
+
+    // Queues filename to be loaded or built, once per process. The first
+    // requester's report receives the build's log lines on the builder thread.
+    void request(const void *owner, const std::string &filename, double probeStep, Report report);
+    // The index of filename, or null while it is pending or after it failed.
+    std::shared_ptr<const KeyframeIndex> find(const std::string &filename);
+    // Drops owner's reports; returns once none of them is running.
+    void release(const void *owner);
+
+private:
+    struct Job {
+        const void *owner;
+        std::string filename;
+        double probeStep;
+        Report report;
+    };
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::unordered_map<std::string, std::shared_ptr<const KeyframeIndex>> indexes;
+    std::unordered_set<std::string> requested;  // Queued, built or failed; never retried.
+    std::deque<Job> queue;
+    Job building{};                    // Its report is cleared by release().
+    const void *reporting = nullptr;   // Owner whose report is running.
+    std::atomic<bool> stop{false};
+    std::thread builder;
+    void run();
+};
+
+#endif // KEYFRAMEINDEX_H
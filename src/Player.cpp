@@ -1,7 +1,9 @@
 #include "Player.h"
+#include "Config.h"
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cstdio>
 
 
 #ifdef _WIN32
@@ -14,25 +16,184 @@
 #endif
 
 #include <thread>
+#include <algorithm>
+#include <cmath>
+
+// reply_userdata ids for observed properties.
+enum ObservedProperty : uint64_t {
+    OBS_PAUSE = 1,
+    OBS_TIME_POS,
+    OBS_PATH,
+    OBS_EOF_REACHED,
+    OBS_DROPPED_FRAMES,
+    OBS_DURATION
+};
 
 Player::Player()
     : current_video(""),
       attract_video("attract.mp4"),
+      player_name("default"),
       use_attract(true),
       altEOF_mode(false),
       udp_listen_port(12345),
       udp_send_port(12346),
       controller_ip("192.168.1.100"),
-      player_name("default"),
-      ctx(nullptr)
+      headless(false),
+      screen(1),
+      reactor(nullptr),
+      state_pos_quantum_ms(500),
+      state_min_interval_ms(100),
+      keyframe_index(true),
+      keyframe_probe_step(1.0),
+      seek_fast_tolerance(0.5),
+      cache_budget(std::make_shared<CacheBudget>()),
+      keyframe_indexes(std::make_shared<KeyframeIndexCache>()),
+      config_index(0),
+      ctx(nullptr),
+      statePushPending(false),
+      firstFrameMs(-1),
+      lastWatchPos(-1.0),
+      watchResync(false),
+      seekRequested(false),
+      cacheAllocation{0, 0},
+      seekBaseMs(30.0),
+      seekDecodeMsPerSec(40.0),
+      randomGen(std::random_device{}()),
+      reloads([this]() { readReload(); })
 {
     // Optionally, initialize other members here.
 }
 
 Player::~Player() {
-    if (ctx) {
-        mpv_terminate_destroy(ctx);
+    reloads.stop();
+    if (keyframe_indexes)
+        keyframe_indexes->release(this);
+    if (cache_budget)
+        cache_budget->release(this);
+    destroyContext();
+}
+
+// A profile that could draw an empty sequence or an invalid wait is refused
+// when the config is read, not when RANDOM ON plays it.
+static bool readRandomProfile(const json &p, Player::RandomProfile &profile, std::string &error) {
+    if (!p.is_object()) {
+        error = "not an object";
+        return false;
+    }
+    if (!readRandomClips(p, profile.clips, profile.wait_min_ms, profile.wait_max_ms, profile.length_min,
+                         profile.length_max, error))
+        return false;
+    profile.gap_ms = p.value("gap_ms", 0);
+    if (profile.gap_ms < 0) {
+        error = "gap_ms must not be negative";
+        return false;
+    }
+    return true;
+}
+
+void Player::configure(const json &config, bool reloading) {
+    // Every key is read before any is assigned, so a wrong-typed field throws
+    // json::exception with the current settings untouched.
+    int listenPort = config.value("controller_send_port", udp_listen_port);
+    int sendPort = config.value("controller_receive_port", udp_send_port);
+    std::string controllerIp = config.value("controller_ip", controller_ip);
+    bool useAttract = config.value("use_attract", use_attract);
+    std::string attractVideo = config.value("attract_video", attract_video);
+    bool isHeadless = config.value("headless", headless);
+    int screenIndex = config.value("screen", screen);
+    int posQuantumMs = config.value("state_pos_quantum_ms", state_pos_quantum_ms);
+    int minIntervalMs = config.value("state_min_interval_ms", state_min_interval_ms);
+
+    bool useKeyframeIndex = config.value("keyframe_index", keyframe_index);
+    double probeStep = config.value("keyframe_probe_step", keyframe_probe_step);
+    if (probeStep < KeyframeIndex::MIN_PROBE_STEP) {
+        // A step of 0 or less would never finish probing.
+        std::cout << "keyframe_probe_step " << probeStep << " raised to " << KeyframeIndex::MIN_PROBE_STEP
+                  << std::endl;
+        probeStep = KeyframeIndex::MIN_PROBE_STEP;
+    }
+    double fastTolerance = config.value("seek_fast_tolerance", seek_fast_tolerance);
+
+    // Time-position watch points: { "file.mp4": [ { "at": 42.0, "label": "cue42" } ] }
+    std::unordered_map<std::string, std::vector<WatchPoint>> watchPoints;
+    if (config.contains("watch_points") && config["watch_points"].is_object()) {
+        for (auto& item : config["watch_points"].items()) {
+            for (const auto& wp : item.value())
+                watchPoints[item.key()].push_back(
+                    {wp.value("at", 0.0), wp.value("label", std::string())});
+        }
+    }
+
+    // RANDOM ON <profile> profiles:
+    // { "dots": { "clips": [...], "wait_ms": [30000, 170000], "sequence_length": [1, 10], "gap_ms": 0 } }
+    std::unordered_map<std::string, RandomProfile> randomProfiles;
+    if (config.contains("random_profiles") && config["random_profiles"].is_object()) {
+        for (auto& item : config["random_profiles"].items()) {
+            RandomProfile profile;
+            std::string error;
+            if (!readRandomProfile(item.value(), profile, error)) {
+                std::cout << "random profile " << item.key() << " rejected: " << error << std::endl;
+                continue;
+            }
+            randomProfiles[item.key()] = profile;
+        }
+    }
+
+    std::string playerName = config.value("player_name", player_name);
+
+    if (!reloading) {
+        udp_listen_port = listenPort;
+        udp_send_port = sendPort;
+        controller_ip = controllerIp;
+        headless = isHeadless;
+        screen = screenIndex;
+    } else if (listenPort != udp_listen_port || sendPort != udp_send_port || controllerIp != controller_ip ||
+               isHeadless != headless || screenIndex != screen) {
+        // The sockets and the mpv window already exist; these stay as started.
+        std::cout << "RELOAD: ports, controller_ip, headless and screen take effect on restart" << std::endl;
+    }
+    use_attract = useAttract;
+    attract_video = attractVideo;
+    state_pos_quantum_ms = posQuantumMs;
+    state_min_interval_ms = minIntervalMs;
+    keyframe_index = useKeyframeIndex;
+    keyframe_probe_step = probeStep;
+    seek_fast_tolerance = fastTolerance;
+    watch_points = std::move(watchPoints);
+    random_profiles = std::move(randomProfiles);
+    player_name = playerName;
+}
+
+void Player::reload() {
+    // Parsing happens on the reload thread; the settings are applied on the event loop.
+    reloads.request();
+}
+
+void Player::readReload() {
+    json config;
+    if (!readConfigFile(CONFIG_PATH, config)) {
+        post([](UdpComm &udp) { udp.sendLog(std::string("RELOAD failed: cannot read ") + CONFIG_PATH); });
+        return;
+    }
+    std::vector<json> configs = playerConfigs(config);
+    if (config_index >= configs.size()) {
+        post([](UdpComm &udp) { udp.sendLog("RELOAD failed: player entry no longer exists"); });
+        return;
     }
+    json mine = configs[config_index];
+    post([this, mine, config](UdpComm &udp) {
+        try {
+            configure(mine, true);
+            // The budget is shared by the players and locks itself; new
+            // sizes apply from each player's next load.
+            cache_budget->configure(config);
+        } catch (const json::exception &e) {
+            udp.sendLog(std::string("RELOAD failed, keeping the current settings: ") + e.what());
+            return;
+        }
+        resolveWatchPoints();
+        udp.sendLog("RELOAD done");
+    });
 }
 
 void Player::setOption(mpv_handle* ctx, const char* name, const char* value, UdpComm &udp) {
@@ -44,8 +205,41 @@ void Player::setOption(mpv_handle* ctx, const char* name, const char* value, Udp
         // udp.sendLog(std::string("Set option '") + name + "' to '" + value + "'");
 }
 
+void Player::applyCacheBudget(const std::string &filename) {
+    long long size = -1;
+    std::ifstream media(filename, std::ios::binary | std::ios::ate);
+    if (media)
+        size = static_cast<long long>(media.tellg());
+
+    cacheAllocation = cache_budget->acquire(this, size);
+    // Takes effect for the next loadfile's demuxer, or resizes the current one.
+    mpv_set_property_string(ctx, "demuxer-max-bytes", std::to_string(cacheAllocation.forwardBytes).c_str());
+    mpv_set_property_string(ctx, "demuxer-max-back-bytes", std::to_string(cacheAllocation.backBytes).c_str());
+}
+
+bool Player::cacheUsage(long long &totalBytes, long long &forwardBytes) {
+    totalBytes = forwardBytes = 0;
+    mpv_node state;
+    if (mpv_get_property(ctx, "demuxer-cache-state", MPV_FORMAT_NODE, &state) < 0)
+        return false;
+    if (state.format == MPV_FORMAT_NODE_MAP) {
+        for (int i = 0; i < state.u.list->num; i++) {
+            const mpv_node &value = state.u.list->values[i];
+            if (value.format != MPV_FORMAT_INT64)
+                continue;
+            if (strcmp(state.u.list->keys[i], "total-bytes") == 0)
+                totalBytes = value.u.int64;
+            else if (strcmp(state.u.list->keys[i], "fw-bytes") == 0)
+                forwardBytes = value.u.int64;
+        }
+    }
+    mpv_free_node_contents(&state);
+    return true;
+}
+
 void Player::loadFileCommand(mpv_handle* ctx, const std::string &filename, bool auto_resume, UdpComm &udp) {
     current_video = filename;
+    applyCacheBudget(filename);
     const char* cmd[] = {"loadfile", filename.c_str(), "replace", nullptr};
     int status = mpv_command(ctx, cmd);
     if (status < 0)
@@ -60,6 +254,395 @@ void Player::loadFileCommand(mpv_handle* ctx, const std::string &filename, bool
     }
 }
 
+void Player::observeProperties(UdpComm &udp) {
+    struct { uint64_t id; const char *name; mpv_format format; } props[] = {
+        {OBS_PAUSE,          "pause",            MPV_FORMAT_FLAG},
+        {OBS_TIME_POS,       "time-pos",         MPV_FORMAT_DOUBLE},
+        {OBS_PATH,           "path",             MPV_FORMAT_STRING},
+        {OBS_EOF_REACHED,    "eof-reached",      MPV_FORMAT_FLAG},
+        {OBS_DROPPED_FRAMES, "frame-drop-count", MPV_FORMAT_INT64},
+        {OBS_DURATION,       "duration",         MPV_FORMAT_DOUBLE},
+    };
+    for (auto &p : props) {
+        int error = mpv_observe_property(ctx, p.id, p.name, p.format);
+        if (error < 0)
+            udp.sendLog(std::string("Failed to observe property '") + p.name + "': " + mpv_error_string(error));
+    }
+}
+
+void Player::handlePropertyChange(const mpv_event_property *prop, uint64_t id) {
+    // format is MPV_FORMAT_NONE when the property is unavailable (e.g. no file loaded).
+    bool available = prop->format != MPV_FORMAT_NONE && prop->data != nullptr;
+    switch (id) {
+        case OBS_PAUSE:
+            observed.paused = available ? *static_cast<int*>(prop->data) != 0 : true;
+            break;
+        case OBS_TIME_POS:
+            observed.time_pos = available ? *static_cast<double*>(prop->data) : -1.0;
+            break;
+        case OBS_PATH:
+            observed.path = available ? *static_cast<char**>(prop->data) : "";
+            break;
+        case OBS_EOF_REACHED:
+            observed.eof_reached = available && *static_cast<int*>(prop->data) != 0;
+            break;
+        case OBS_DROPPED_FRAMES:
+            observed.dropped_frames = available ? *static_cast<int64_t*>(prop->data) : 0;
+            break;
+        case OBS_DURATION:
+            // Not pushed; only needed to resolve end-relative watch points.
+            observed.duration = available ? *static_cast<double*>(prop->data) : -1.0;
+            resolveWatchPoints();
+            return;
+        default:
+            return;
+    }
+    statePushPending = true;
+}
+
+double Player::quantisePos(double pos) const {
+    if (pos < 0.0 || state_pos_quantum_ms <= 0)
+        return pos;
+    double quantum = state_pos_quantum_ms / 1000.0;
+    return std::floor(pos / quantum) * quantum;
+}
+
+void Player::pushState(UdpComm &udp) {
+    if (!statePushPending)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastStatePush < std::chrono::milliseconds(state_min_interval_ms))
+        return;  // Rate limited; nextWakeup() brings us back once the interval has passed.
+    statePushPending = false;
+
+    // Only the fields that changed since the last push are sent.
+    json delta = json::object();
+    if (observed.paused != pushed.paused)
+        delta["pause"] = observed.paused;
+    double pos = quantisePos(observed.time_pos);
+    if (pos != quantisePos(pushed.time_pos))
+        delta["pos"] = pos < 0.0 ? json(nullptr) : json(pos);
+    if (observed.path != pushed.path)
+        delta["path"] = observed.path;
+    if (observed.eof_reached != pushed.eof_reached)
+        delta["eof"] = observed.eof_reached;
+    if (observed.dropped_frames != pushed.dropped_frames)
+        delta["dropped"] = observed.dropped_frames;
+
+    pushed = observed;
+    if (delta.empty())
+        return;
+    lastStatePush = now;
+    udp.sendLog("STATE " + delta.dump());
+}
+
+void Player::sendStatus(UdpComm &udp) {
+    // Taken on the event loop, so all fields belong to the same moment.
+    long long cacheTotal = 0, cacheForward = 0;
+    cacheUsage(cacheTotal, cacheForward);
+    std::string loop = "no";
+    if (char *value = mpv_get_property_string(ctx, "loop-file")) {
+        loop = value;
+        mpv_free(value);
+    }
+
+    json status;
+    status["v"] = 1;
+    status["name"] = player_name;
+    status["file"] = current_video;
+    status["pos"] = observed.time_pos < 0.0 ? json(nullptr) : json(observed.time_pos);
+    status["pause"] = observed.paused;
+    status["loop"] = loop;
+    status["attract"] = {{"video", attract_video}, {"use", use_attract}};
+    status["cache"] = {{"used", cacheTotal}, {"fw", cacheForward},
+                       {"budget", cacheAllocation.forwardBytes + cacheAllocation.backBytes}};
+    status["dropped"] = observed.dropped_frames;
+    status["uptime_s"] = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - startedAt).count();
+    status["first_frame_ms"] = firstFrameMs < 0 ? json(nullptr) : json(firstFrameMs);
+    udp.sendLog("STATUS " + status.dump());
+}
+
+double Player::nextWakeup() const {
+    bool pending = false;
+    std::chrono::steady_clock::time_point due;
+    if (statePushPending) {
+        due = lastStatePush + std::chrono::milliseconds(state_min_interval_ms);
+        pending = true;
+    }
+    if (sequence.holding && (!pending || sequence.resumeAt < due)) {
+        due = sequence.resumeAt;
+        pending = true;
+    }
+    if (randomMode.waiting && (!pending || randomMode.startAt < due)) {
+        due = randomMode.startAt;
+        pending = true;
+    }
+    if (!pending)
+        return -1.0;
+    double remaining = std::chrono::duration<double>(due - std::chrono::steady_clock::now()).count();
+    return remaining > 0.0 ? remaining : 0.0;
+}
+
+void Player::runTimers(UdpComm &udp) {
+    if (sequence.holding && std::chrono::steady_clock::now() >= sequence.resumeAt) {
+        sequence.holding = false;
+        const char* play_cmd[] = {"set", "pause", "no", nullptr};
+        mpv_command(ctx, play_cmd);
+    }
+    if (randomMode.waiting && std::chrono::steady_clock::now() >= randomMode.startAt) {
+        randomMode.waiting = false;
+        playRandomSequence(udp);
+    }
+}
+
+void Player::startRandom(const std::string &profileName, UdpComm &udp) {
+    auto it = random_profiles.find(profileName);
+    if (it == random_profiles.end() || it->second.clips.empty()) {
+        udp.sendLog("RANDOM error: unknown or empty profile " + profileName);
+        return;
+    }
+    randomMode.active = true;
+    randomMode.profile = it->second;
+    scheduleRandomSequence();
+    udp.sendLog("RANDOM ON " + profileName);
+}
+
+void Player::stopRandom(UdpComm &udp) {
+    if (!randomMode.active)
+        return;
+    randomMode.active = false;
+    randomMode.waiting = false;
+    udp.sendLog("RANDOM OFF");
+}
+
+void Player::scheduleRandomSequence() {
+    const RandomProfile &profile = randomMode.profile;
+    std::uniform_int_distribution<int> waitDist(profile.wait_min_ms, std::max(profile.wait_min_ms, profile.wait_max_ms));
+    randomMode.waiting = true;
+    randomMode.startAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitDist(randomGen));
+}
+
+void Player::playRandomSequence(UdpComm &udp) {
+    const RandomProfile &profile = randomMode.profile;
+    std::uniform_int_distribution<int> lengthDist(profile.length_min, std::max(profile.length_min, profile.length_max));
+    std::uniform_int_distribution<size_t> clipDist(0, profile.clips.size() - 1);
+    // The whole sequence is drawn up front, so SEQ can prefetch each next clip.
+    std::vector<SeqItem> items;
+    int length = lengthDist(randomGen);
+    for (int i = 0; i < length; i++)
+        items.push_back({profile.clips[clipDist(randomGen)], profile.gap_ms});
+    startSequence(items, udp);
+}
+
+void Player::startSequence(std::vector<SeqItem> items, UdpComm &udp) {
+    if (items.empty()) {
+        udp.sendLog("SEQ error: empty sequence");
+        return;
+    }
+    sequence = Sequence();
+    sequence.items = std::move(items);
+    sequence.active = true;
+    altEOF_mode = false;
+    setOption(ctx, "loop-file", "0", udp);
+    const char* play_cmd[] = {"set", "pause", "no", nullptr};
+    mpv_command(ctx, play_cmd);
+    loadFileCommand(ctx, sequence.items[0].file, true, udp);
+    appendNextSequenceItem(udp);
+    udp.sendLog("SEQSTART " + std::to_string(sequence.items.size()));
+}
+
+void Player::stopSequence(UdpComm &udp) {
+    if (!sequence.active)
+        return;
+    sequence.active = false;
+    sequence.holding = false;
+    const char* clear_cmd[] = {"playlist-clear", nullptr};
+    mpv_command(ctx, clear_cmd);
+    udp.sendLog("SEQEND stopped");
+}
+
+void Player::appendNextSequenceItem(UdpComm &udp) {
+    size_t next = sequence.current + 1;
+    if (next >= sequence.items.size())
+        return;
+    // The budget is applied when the item becomes current; sizing it here
+    // would take the playing file's reservation and resize its demuxer.
+    const std::string &file = sequence.items[next].file;
+    const char* append_cmd[] = {"loadfile", file.c_str(), "append", nullptr};
+    int status = mpv_command(ctx, append_cmd);
+    if (status < 0)
+        udp.sendLog("SEQ error appending " + file + ": " + mpv_error_string(status));
+}
+
+bool Player::advanceSequence(UdpComm &udp) {
+    size_t finished = sequence.current;
+    if (finished + 1 >= sequence.items.size()) {
+        sequence.active = false;
+        udp.sendLog("SEQEND");
+        if (randomMode.active)
+            scheduleRandomSequence();
+        return false;
+    }
+
+    // mpv moves on to the prefetched entry by itself; a gap holds it paused.
+    sequence.current = finished + 1;
+    current_video = sequence.items[sequence.current].file;
+    applyCacheBudget(current_video);
+    int gap = sequence.items[finished].gap_ms;
+    if (gap > 0) {
+        const char* pause_cmd[] = {"set", "pause", "yes", nullptr};
+        mpv_command(ctx, pause_cmd);
+        sequence.holding = true;
+        sequence.resumeAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(gap);
+    }
+    appendNextSequenceItem(udp);
+    return true;
+}
+
+void Player::post(std::function<void(UdpComm&)> task) {
+    std::lock_guard<std::mutex> lock(taskMutex);
+    tasks.push_back(std::move(task));
+    if (ctx)
+        mpv_wakeup(ctx);
+}
+
+void Player::destroyContext() {
+    mpv_handle *handle;
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        handle = ctx;
+        ctx = nullptr;
+    }
+    if (handle)
+        mpv_terminate_destroy(handle);
+}
+
+void Player::runTasks(UdpComm &udp) {
+    std::vector<std::function<void(UdpComm&)>> pending;
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        pending.swap(tasks);
+    }
+    for (auto &task : pending)
+        task(udp);
+}
+
+void Player::resolveWatchPoints() {
+    activeWatch.clear();
+    auto it = watch_points.find(current_video);
+    if (it == watch_points.end())
+        return;
+    for (const auto &wp : it->second) {
+        double at = wp.at;
+        if (at < 0.0) {
+            if (observed.duration <= 0.0)
+                continue;  // Resolved again once the duration is known.
+            at += observed.duration;
+        }
+        activeWatch.push_back({at, wp.label});
+    }
+}
+
+void Player::checkWatchPoints(UdpComm &udp) {
+    double pos = observed.time_pos;
+    if (pos < 0.0) {
+        lastWatchPos = -1.0;
+        return;
+    }
+    // A jump from the last second of the file back into its first second that
+    // no SEEK asked for is loop-file starting the next pass, which crosses
+    // its watch points again. Any other jump is a seek and crosses nothing.
+    bool wrapped = !seekRequested && pos < lastWatchPos && pos < LOOP_WRAP_WINDOW &&
+                   observed.duration > 0.0 && lastWatchPos > observed.duration - LOOP_WRAP_WINDOW;
+    if (wrapped) {
+        watchResync = false;
+        lastWatchPos = -1.0;
+    } else if (watchResync) {
+        watchResync = false;
+        seekRequested = false;
+        lastWatchPos = pos;
+        return;
+    }
+    // Fire each watch point crossed between the previous and the current position.
+    // mpv reports time-pos once per frame, so the emission is late by at most one frame.
+    for (const auto &w : activeWatch) {
+        if (lastWatchPos < w.at && w.at <= pos) {
+            char late[32];
+            snprintf(late, sizeof(late), "%.1f", (pos - w.at) * 1000.0);
+            udp.sendLog("TIMEPOS " + w.label + " at=" + std::to_string(w.at) +
+                        " pos=" + std::to_string(pos) + " late_ms=" + late);
+        }
+    }
+    lastWatchPos = pos;
+}
+
+void Player::ensureKeyframeIndex(const std::string &filename) {
+    if (!keyframe_index)
+        return;
+    keyframe_indexes->request(this, filename, keyframe_probe_step, [this](const std::string &line) {
+        post([line](UdpComm &udp) { udp.sendLog(line); });
+    });
+}
+
+void Player::seekTo(double target, const std::string &mode, UdpComm &udp) {
+    auto index = keyframe_indexes->find(current_video);
+    // An empty index says nothing about the file; seek as if there were none.
+    if (index && index->keyframes.empty())
+        index = nullptr;
+    double keyframe = index ? index->previousKeyframe(target) : 0.0;
+
+    // AUTO takes the fast path only when a keyframe lies close enough to the target.
+    bool exact = mode != "FAST";
+    double seekPos = target;
+    if (mode == "AUTO" && index) {
+        double nearest = index->nearestKeyframe(target);
+        if (std::fabs(nearest - target) <= seek_fast_tolerance) {
+            exact = false;
+            seekPos = nearest;
+        }
+    }
+
+    pendingSeek.active = true;
+    pendingSeek.exact = exact;
+    pendingSeek.target = target;
+    // Without an index the decode distance is unknown; assume a one second GOP.
+    pendingSeek.decodeDistance = exact ? (index ? target - keyframe : 1.0) : 0.0;
+    pendingSeek.expectedMs = seekBaseMs + seekDecodeMsPerSec * pendingSeek.decodeDistance;
+    pendingSeek.start = std::chrono::steady_clock::now();
+
+    std::string pos = std::to_string(seekPos);
+    const char* seek_cmd[] = {"seek", pos.c_str(), exact ? "absolute+exact" : "absolute+keyframes", nullptr};
+    int status = mpv_command(ctx, seek_cmd);
+    seekRequested = status >= 0;
+    if (status < 0) {
+        pendingSeek.active = false;
+        udp.sendLog("SEEK error: " + std::string(mpv_error_string(status)));
+    }
+}
+
+void Player::finishSeek(UdpComm &udp) {
+    if (!pendingSeek.active)
+        return;
+    pendingSeek.active = false;
+    double actualMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - pendingSeek.start).count();
+
+    // Refine the latency model with an exponential moving average.
+    const double alpha = 0.2;
+    if (!pendingSeek.exact || pendingSeek.decodeDistance < 0.05)
+        seekBaseMs += alpha * (actualMs - seekBaseMs);
+    else
+        seekDecodeMsPerSec += alpha * ((actualMs - seekBaseMs) / pendingSeek.decodeDistance - seekDecodeMsPerSec);
+    if (seekDecodeMsPerSec < 0.0)
+        seekDecodeMsPerSec = 0.0;
+
+    char report[160];
+    snprintf(report, sizeof(report), "SEEKDONE target=%.3f pos=%.3f mode=%s expected_ms=%.1f actual_ms=%.1f",
+             pendingSeek.target, observed.time_pos, pendingSeek.exact ? "exact" : "fast",
+             pendingSeek.expectedMs, actualMs);
+    udp.sendLog(report);
+}
 
 //
 // void Player::printControls(UdpComm &udp) {
@@ -81,7 +664,23 @@ void Player::loadFileCommand(mpv_handle* ctx, const std::string &filename, bool
 //     udp.sendLog(controls);
 // }
 
-void Player::processCommand(const std::string &cmd, UdpComm &udp, const sockaddr_in &src, socklen_t srcLen) {
+void Player::processCommand(const std::string &cmd) {
+    // Every command runs on the event loop, in arrival order. Loads, sequence
+    // and random mode, and the settings a reload changes are then only ever
+    // touched by that one thread, and a PLAY cannot be overtaken by the next
+    // sequence item.
+    post([this, cmd](UdpComm &udp) { runCommand(cmd, udp); });
+}
+
+void Player::runCommand(const std::string &cmd, UdpComm &udp) {
+
+    // Commands that replace what is playing end a running SEQ and RANDOM mode.
+    if (cmd.rfind("LOAD ", 0) == 0 || cmd.rfind("LOOPS ", 0) == 0 || cmd.rfind("PLAY ", 0) == 0 ||
+        cmd.rfind("ALTPLAY ", 0) == 0 || cmd.rfind("ATTRACT", 0) == 0 || cmd == "CLEAR" || cmd == "UNLOAD") {
+        sequence.active = false;
+        sequence.holding = false;
+        stopRandom(udp);
+    }
 
     // LOAD {FILENAME} command: Load file with no explicit looping.
     if (cmd.substr(0, 5) == "LOAD ") {
@@ -152,13 +751,26 @@ void Player::processCommand(const std::string &cmd, UdpComm &udp, const sockaddr
         const char* stop_cmd[] = {"set", "pause", "yes", nullptr};
         mpv_command(ctx, stop_cmd);
     }
-    // SEEK <time> command: Seek to the specified time.
+    // SEEK <time> [EXACT|FAST|AUTO] command: Seek to the specified time.
+    // EXACT (default) decodes to the exact frame, FAST lands on a keyframe and AUTO
+    // picks FAST when the keyframe index has a keyframe within seek_fast_tolerance.
     else if (cmd.substr(0, 5) == "SEEK ") {
-        std::string timeStr = cmd.substr(5);
-        udp.sendLog("SEEK command received. Time: " + timeStr);
-        // Build command: seek <time> absolute
-        const char* seek_cmd[] = {"seek", timeStr.c_str(), "absolute", nullptr};
-        mpv_command(ctx, seek_cmd);
+        std::string rest = cmd.substr(5);
+        std::string timeStr = rest.substr(0, rest.find(' '));
+        std::string mode = timeStr.size() < rest.size() ? rest.substr(timeStr.size() + 1) : "EXACT";
+        udp.sendLog("SEEK command received. Time: " + timeStr + " Mode: " + mode);
+        double target = 0.0;
+        try {
+            target = std::stod(timeStr);
+        } catch (const std::exception &) {
+            udp.sendLog("SEEK command error: invalid time " + timeStr);
+            return;
+        }
+        if (mode != "EXACT" && mode != "FAST" && mode != "AUTO") {
+            udp.sendLog("SEEK command error: unknown mode " + mode);
+            return;
+        }
+        seekTo(target, mode, udp);
     }
     // VOL <number> command: Set volume.
     else if (cmd.substr(0, 4) == "VOL ") {
@@ -211,14 +823,104 @@ void Player::processCommand(const std::string &cmd, UdpComm &udp, const sockaddr
         use_attract = false;
         udp.sendLog("USEATTRACT OFF command received. Attract mode disabled.");
     }
-    // STATUS command: Report current status.
+    // WATCH <seconds> <label>: Emit "TIMEPOS <label>" when the current file crosses <seconds>.
+    // A negative time counts back from the end of the file. WATCH CLEAR removes the file's points.
+    else if (cmd.rfind("WATCH ", 0) == 0) {
+        std::string rest = cmd.substr(6);
+        if (rest == "CLEAR") {
+            watch_points.erase(current_video);
+            resolveWatchPoints();
+            udp.sendLog("WATCH points cleared for " + current_video);
+        } else {
+            auto spacePos = rest.find(' ');
+            double at = 0.0;
+            bool valid = spacePos != std::string::npos;
+            if (valid) {
+                try {
+                    at = std::stod(rest.substr(0, spacePos));
+                } catch (const std::exception &) {
+                    valid = false;
+                }
+            }
+            std::string label = valid ? rest.substr(spacePos + 1) : "";
+            if (!valid || label.empty() || label.find(' ') != std::string::npos) {
+                udp.sendLog("WATCH command error: expected WATCH <seconds> <label>");
+            } else {
+                watch_points[current_video].push_back({at, label});
+                resolveWatchPoints();
+                udp.sendLog("WATCH " + label + " at " + std::to_string(at) + " for " + current_video);
+            }
+        }
+    }
+    // SEQ <file>[,<gap_ms>] ...: Play the clips in order on the player, pausing gap_ms
+    // after each. Replies SEQSTART <n> and SEQEND. SEQ STOP abandons the sequence.
+    else if (cmd.rfind("SEQ ", 0) == 0) {
+        std::string rest = cmd.substr(4);
+        if (rest == "STOP") {
+            stopRandom(udp);
+            stopSequence(udp);
+        } else {
+            std::vector<SeqItem> items;
+            bool valid = true;
+            size_t pos = 0;
+            while (valid && pos < rest.size()) {
+                size_t end = rest.find(' ', pos);
+                if (end == std::string::npos)
+                    end = rest.size();
+                std::string token = rest.substr(pos, end - pos);
+                pos = end + 1;
+                if (token.empty())
+                    continue;
+                SeqItem item{token, 0};
+                auto comma = token.rfind(',');
+                if (comma != std::string::npos) {
+                    item.file = token.substr(0, comma);
+                    try {
+                        item.gap_ms = std::stoi(token.substr(comma + 1));
+                    } catch (const std::exception &) {
+                        valid = false;
+                    }
+                }
+                items.push_back(item);
+            }
+            if (!valid || items.empty()) {
+                udp.sendLog("SEQ command error: expected SEQ <file>[,<gap_ms>] ...");
+            } else {
+                startSequence(items, udp);
+            }
+        }
+    }
+    // RANDOM ON <profile> / RANDOM OFF: Player-side random clip generator (see random_profiles).
+    else if (cmd.rfind("RANDOM ON ", 0) == 0) {
+        std::string profile = cmd.substr(10);
+        startRandom(profile, udp);
+    }
+    else if (cmd == "RANDOM OFF") {
+        // Like the controller-side generator, switching off also clears the screen.
+        stopRandom(udp);
+        stopSequence(udp);
+        const char* unload_cmd[] = {"stop", nullptr};
+        mpv_command(ctx, unload_cmd);
+    }
+    // RELOAD command: Re-read player.json and apply this player's settings.
+    // Ports, screen and headless only take effect on restart.
+    else if (cmd == "RELOAD") {
+        reload();
+    }
+    // CACHE command: Report the demuxer cache budget and actual usage.
+    else if (cmd == "CACHE") {
+        long long total = 0, forward = 0;
+        cacheUsage(total, forward);
+        udp.sendLog("CACHE used=" + std::to_string(total) + " fw=" + std::to_string(forward) +
+                    " budget_fw=" + std::to_string(cacheAllocation.forwardBytes) +
+                    " budget_back=" + std::to_string(cacheAllocation.backBytes) +
+                    " host_reserved=" + std::to_string(cache_budget->reservedBytes()) +
+                    " host_cap=" + std::to_string(cache_budget->hostCapBytes()) +
+                    " mem_available=" + std::to_string(CacheBudget::availableMemory()));
+    }
+    // STATUS command: Report current status as a single "STATUS {json}" datagram.
     else if (cmd == "STATUS") {
-        udp.sendLog("STATUS command received.");
-        udp.sendLog("Current video: " + current_video);
-        udp.sendLog("Attract video: " + attract_video);
-        udp.sendLog("use_attract: " + std::string(use_attract ? "true" : "false"));
-        // Optionally add additional status information.
-        udp.sendLog("READY");
+        sendStatus(udp);
     }
     else {
         udp.sendLog("Unrecognized command: " + cmd);
@@ -227,12 +929,16 @@ void Player::processCommand(const std::string &cmd, UdpComm &udp, const sockaddr
 
 
 void Player::start() {
+    startedAt = std::chrono::steady_clock::now();
     // Create a local UdpComm instance using our configuration.
     UdpComm udp(udp_listen_port, udp_send_port, controller_ip);
     udp.sendLog("Hello from player: " + player_name + "\n");
 
     // Create MPV context.
-    ctx = mpv_create();
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        ctx = mpv_create();
+    }
     if (!ctx) {
         udp.sendLog("Failed to create MPV context");
         return;
@@ -240,45 +946,71 @@ void Player::start() {
     // Set MPV options.
     setOption(ctx, "input-terminal", "no", udp);
     setOption(ctx, "terminal", "no", udp);
-    setOption(ctx, "input-vo-keyboard", "yes", udp);
-    setOption(ctx, "input-default-bindings", "yes", udp);
-    setOption(ctx, "force-window", "yes", udp);
-    setOption(ctx, "border", "no", udp);
+    if (headless) {
+        // No window, display or audio device: frames are still demuxed and
+        // decoded in software, then discarded by the null outputs.
+        setOption(ctx, "vo", "null", udp);
+        setOption(ctx, "ao", "null", udp);
+        setOption(ctx, "hwdec", "no", udp);
+    } else {
+        setOption(ctx, "input-vo-keyboard", "yes", udp);
+        setOption(ctx, "input-default-bindings", "yes", udp);
+        setOption(ctx, "force-window", "yes", udp);
+        setOption(ctx, "border", "no", udp);
+        setOption(ctx, "autofit", "500x500", udp);
+        setOption(ctx, "screen", std::to_string(screen).c_str(), udp);
+        setOption(ctx, "fs-screen", std::to_string(screen).c_str(), udp);
+        setOption(ctx, "window-dragging", "yes", udp);
+        setOption(ctx, "hwdec", "auto-safe", udp);
+        setOption(ctx, "fullscreen", "yes", udp);
+    }
     setOption(ctx, "keep-open", "no", udp);
-    setOption(ctx, "autofit", "500x500", udp);
-    setOption(ctx, "screen", "1", udp);
-    setOption(ctx, "window-dragging", "yes", udp);
-    setOption(ctx, "demuxer-max-bytes", "1GiB", udp);
-    setOption(ctx, "demuxer-max-back-bytes", "1GiB", udp);
+    setOption(ctx, "prefetch-playlist", "yes", udp);
     setOption(ctx, "loop-file", "0", udp);
     setOption(ctx, "hr-seek", "yes", udp);
     setOption(ctx, "hr-seek-framedrop", "no", udp);
     setOption(ctx, "resume-playback", "no", udp);
-    setOption(ctx, "hwdec", "auto-safe", udp);
     setOption(ctx, "volume", "100", udp);
     setOption(ctx, "osd-level", "0", udp);
-    setOption(ctx, "fullscreen", "yes", udp);
 
     int status = mpv_initialize(ctx);
     if (status < 0) {
         udp.sendLog("Failed to initialize MPV: " + std::string(mpv_error_string(status)));
-        mpv_terminate_destroy(ctx);
+        destroyContext();
         return;
     }
 
-    // Start the UDP listener in a separate thread.
-    std::thread listenerThread([this, &udp]() {
-        udp.runListener([this, &udp](const std::string &cmd, const sockaddr_in &src, socklen_t srcLen) {
-            this->processCommand(cmd, udp, src, srcLen);
+    auto handler = [this](const std::string &cmd, const sockaddr_in &, socklen_t) {
+        this->processCommand(cmd);
+    };
+    if (reactor) {
+        // Commands arrive on the reactor thread shared with the other players.
+        if (!reactor->add(udp, handler))
+            udp.sendLog("Failed to register player " + player_name + " with the UDP reactor");
+    } else {
+        // Start the UDP listener in a separate thread.
+        std::thread listenerThread([&udp, handler]() {
+            udp.runListener(handler);
         });
-    });
-    listenerThread.detach();
+        listenerThread.detach();
+    }
+
+    observeProperties(udp);
 
     udp.sendLog("MPV Initialized. Waiting for events or quit signal...");
 
     // Main MPV event loop.
     while (true) {
-        mpv_event *event = mpv_wait_event(ctx, -1.0);
+        // Commands and timers run before the wait, so an event is handled as
+        // soon as it is taken, before any command posted after it. A post
+        // during the wait wakes it; mpv keeps a wakeup that arrives between
+        // the two calls.
+        runTasks(udp);
+        runTimers(udp);
+        // A pending STATE goes out on the first pass after its interval, so a
+        // stream of other events cannot hold it back; pushState rate-limits itself.
+        pushState(udp);
+        mpv_event *event = mpv_wait_event(ctx, nextWakeup());
         if (event->event_id == MPV_EVENT_NONE)
             continue;
         if (event->event_id == MPV_EVENT_SHUTDOWN) {
@@ -292,8 +1024,45 @@ void Player::start() {
             udp.sendLog(logMsg);
             continue;
         }
+        if (event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+            handlePropertyChange(reinterpret_cast<mpv_event_property*>(event->data), event->reply_userdata);
+            if (event->reply_userdata == OBS_TIME_POS)
+                checkWatchPoints(udp);
+            continue;
+        }
+        if (event->event_id == MPV_EVENT_START_FILE) {
+            // A new file starts before any watch point, so a point at 0 still fires.
+            lastWatchPos = -1.0;
+            watchResync = false;
+            seekRequested = false;
+            resolveWatchPoints();
+            ensureKeyframeIndex(current_video);
+            continue;
+        }
+        if (event->event_id == MPV_EVENT_PLAYBACK_RESTART) {
+            if (firstFrameMs < 0) {
+                // Boot-to-first-frame, reported once per process.
+                firstFrameMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - startedAt).count();
+                udp.sendLog("FIRSTFRAME boot_ms=" + std::to_string(firstFrameMs) + " file=" + current_video);
+            }
+            finishSeek(udp);
+            continue;
+        }
+        if (event->event_id == MPV_EVENT_SEEK) {
+            watchResync = true;
+            continue;
+        }
         if (event->event_id == MPV_EVENT_END_FILE) {
             auto eef = reinterpret_cast<mpv_event_end_file*>(event->data);
+            // Within a sequence, only the end of the last item is reported.
+            if (sequence.active && (eef->reason == MPV_END_FILE_REASON_EOF ||
+                                    eef->reason == MPV_END_FILE_REASON_ERROR)) {
+                if (eef->reason == MPV_END_FILE_REASON_ERROR)
+                    udp.sendLog("SEQ error playing " + current_video + ": " + mpv_error_string(eef->error));
+                if (advanceSequence(udp))
+                    continue;
+            }
             if (eef->reason == MPV_END_FILE_REASON_ERROR && eef->error != 0) {
                 udp.sendLog("MPV Error: Playback terminated with error: " + std::string(mpv_error_string(eef->error)));
             } else if (eef->reason == MPV_END_FILE_REASON_EOF) {
@@ -312,7 +1081,10 @@ void Player::start() {
             }
         }
     }
+    // udp and the handler die with this frame; the reactor must be done with them.
+    if (reactor)
+        reactor->remove(udp);
     udp.sendLog("Terminating MPV...");
-    mpv_terminate_destroy(ctx);
+    destroyContext();
     udp.sendLog("MPV Terminated.");
 }
@@ -3,10 +3,24 @@
 
 #include <mpv/client.h>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "json.hpp"
 #include "UdpComm.h"
+#include "KeyframeIndex.h"
+#include "CacheBudget.h"
+#include "Config.h"
 
 using json = nlohmann::json;
 
@@ -27,24 +41,200 @@ public:
     int udp_send_port;    // UDP sending port.
     std::string controller_ip;
 
+    // Run mpv with null video/audio outputs and no window (load testing, build boxes).
+    bool headless;
+    int screen;  // Display the fullscreen window is placed on.
+
+    // Shared command reactor; when null the player runs its own listener thread.
+    UdpReactor *reactor;
+
+    // STATE push settings: time-pos is quantised to state_pos_quantum_ms and
+    // pushes are spaced at least state_min_interval_ms apart.
+    int state_pos_quantum_ms;
+    int state_min_interval_ms;
+
+    // Time-position watch point; a negative "at" counts back from the end of the file.
+    struct WatchPoint {
+        double at;
+        std::string label;
+    };
+    // Watch points per filename, applied whenever that file is loaded. They fire
+    // on every pass of a looping file, but not when a seek jumps over them.
+    std::unordered_map<std::string, std::vector<WatchPoint>> watch_points;
+
+    // Keyframe indexes are built in the background on first load and saved next to the media.
+    bool keyframe_index;
+    double keyframe_probe_step;   // Seconds between probes while building an index.
+    double seek_fast_tolerance;   // SEEK AUTO takes the keyframe path within this distance (seconds).
+
+    // Profiles for RANDOM ON <profile>: after a random wait, play a random-length
+    // sequence of random clips from the pool, then wait again.
+    struct RandomProfile {
+        std::vector<std::string> clips;
+        int wait_min_ms = 30000;
+        int wait_max_ms = 170000;
+        int length_min = 1;
+        int length_max = 10;
+        int gap_ms = 0;
+    };
+    std::unordered_map<std::string, RandomProfile> random_profiles;
+
+    // Demuxer cache budget, shared by all players in the process.
+    std::shared_ptr<CacheBudget> cache_budget;
+    // Keyframe indexes, shared by all players in the process so each file is built once.
+    std::shared_ptr<KeyframeIndexCache> keyframe_indexes;
+
     std::unordered_map<std::string, std::string> devices;
     std::vector<json> cues;
 
+    // Index of this player's entry in the config's "players" array (0 without one).
+    size_t config_index;
+
+    // Applies the player keys of a config object. Throws json::exception on a
+    // wrong-typed key, leaving the current settings as they were. When
+    // reloading, the ports, controller_ip, headless and screen are kept, since
+    // they only take effect on restart.
+    void configure(const json &config, bool reloading = false);
+    // Re-reads the config file on the reload thread (see ReloadQueue) and
+    // applies it on the event loop.
+    void reload();
+
     // Start the player (initializes MPV, configures, and runs event and UDP loops).
     void start();
 
-    // Command-processing method called when a UDP command is received.
-    void processCommand(const std::string &cmd, UdpComm &udp, const sockaddr_in &src, socklen_t srcLen);
+    // Command-processing method called when a UDP command is received; hands
+    // the command to the event loop, which replies through its own UdpComm.
+    void processCommand(const std::string &cmd);
 
     // Utility methods.
     void setOption(mpv_handle* ctx, const char* name, const char* value, UdpComm &udp);
     void loadFileCommand(mpv_handle* ctx, const std::string &filename, bool auto_resume, UdpComm &udp);
     void setLoops(mpv_handle* ctx, bool loop, UdpComm &udp);
+    // Sizes the demuxer cache for filename as it becomes the current file.
+    void applyCacheBudget(const std::string &filename);
+    // Current demuxer cache usage in bytes (total and ahead of the playhead).
+    bool cacheUsage(long long &totalBytes, long long &forwardBytes);
     void printControls(UdpComm &udp);
 
 private:
     mpv_handle *ctx;  // MPV context.
 
+    // Playback state as observed through mpv property changes.
+    struct PlaybackState {
+        bool paused = true;
+        double time_pos = -1.0;     // -1 when no file is playing.
+        std::string path;
+        bool eof_reached = false;
+        int64_t dropped_frames = 0;
+        double duration = -1.0;
+    };
+    PlaybackState observed;  // Latest values reported by mpv.
+    PlaybackState pushed;    // Values last sent to the controller.
+    bool statePushPending;
+    std::chrono::steady_clock::time_point lastStatePush;
+    std::chrono::steady_clock::time_point startedAt;
+    long long firstFrameMs;  // Start to first PLAYBACK_RESTART, -1 until then.
+
+    void observeProperties(UdpComm &udp);
+    void handlePropertyChange(const mpv_event_property *prop, uint64_t id);
+    double quantisePos(double pos) const;
+    // Sends a STATE datagram with the fields that changed since the last push.
+    void pushState(UdpComm &udp);
+    // Replies to STATUS with one versioned JSON snapshot; runs on the event loop.
+    void sendStatus(UdpComm &udp);
+    // Timeout for mpv_wait_event, -1 when nothing is pending.
+    double nextWakeup() const;
+
+    // Runs one command on the event loop.
+    void runCommand(const std::string &cmd, UdpComm &udp);
+
+    // Reads the config file and posts the new settings to the event loop.
+    void readReload();
+
+    // Work handed from the UDP listener thread to the mpv event loop.
+    std::mutex taskMutex;
+    std::vector<std::function<void(UdpComm&)>> tasks;
+    void post(std::function<void(UdpComm&)> task);
+    // Destroys ctx once and clears it under taskMutex, so a late post() never
+    // wakes a destroyed handle.
+    void destroyContext();
+    void runTasks(UdpComm &udp);
+
+    // Watch points of the loaded file, resolved to absolute positions.
+    struct ActiveWatch {
+        double at;
+        std::string label;
+    };
+    std::vector<ActiveWatch> activeWatch;
+    double lastWatchPos;     // Raw time-pos seen by the previous crossing check.
+    bool watchResync;        // Set after a seek so the jump is not treated as a crossing.
+    bool seekRequested;      // A SEEK command's seek is under way; a loop wrap is not.
+    // Seconds from the end and from the start within which a backward jump is a loop wrap.
+    static constexpr double LOOP_WRAP_WINDOW = 1.0;
+    void resolveWatchPoints();
+    void checkWatchPoints(UdpComm &udp);
+
+    // Queues the current file with keyframe_indexes; its log lines come back through post().
+    void ensureKeyframeIndex(const std::string &filename);
+
+    CacheBudget::Allocation cacheAllocation;
+
+    // Seek latency model: expected = seekBaseMs + seekDecodeMsPerSec * seconds decoded
+    // from the previous keyframe. Both terms are refined from measured seeks.
+    double seekBaseMs;
+    double seekDecodeMsPerSec;
+    struct PendingSeek {
+        bool active = false;
+        bool exact = true;
+        double target = 0.0;
+        double decodeDistance = 0.0;
+        double expectedMs = 0.0;
+        std::chrono::steady_clock::time_point start;
+    };
+    PendingSeek pendingSeek;
+
+    // Clip sequence run locally by SEQ. The next item is always appended to
+    // mpv's playlist so it is prefetched while the current one plays.
+    struct SeqItem {
+        std::string file;
+        int gap_ms;  // Pause after this item before the next one starts.
+    };
+    struct Sequence {
+        bool active = false;
+        std::vector<SeqItem> items;
+        size_t current = 0;
+        bool holding = false;  // Next item loaded and paused during a gap.
+        std::chrono::steady_clock::time_point resumeAt;
+    };
+    Sequence sequence;
+    void startSequence(std::vector<SeqItem> items, UdpComm &udp);
+    void stopSequence(UdpComm &udp);
+    void appendNextSequenceItem(UdpComm &udp);
+    // Handles END_FILE while a sequence runs; false when the sequence has finished.
+    bool advanceSequence(UdpComm &udp);
+
+    // RANDOM mode state; sequences are played through the SEQ machinery.
+    struct RandomMode {
+        bool active = false;
+        bool waiting = false;
+        RandomProfile profile;
+        std::chrono::steady_clock::time_point startAt;
+    };
+    RandomMode randomMode;
+    std::mt19937 randomGen;
+    void startRandom(const std::string &profileName, UdpComm &udp);
+    void stopRandom(UdpComm &udp);
+    void scheduleRandomSequence();
+    void playRandomSequence(UdpComm &udp);
+
+    // Runs due local timers (sequence gaps, random waits); called on every event loop pass.
+    void runTimers(UdpComm &udp);
+    // Runs on the event loop; mode is EXACT, FAST or AUTO.
+    void seekTo(double target, const std::string &mode, UdpComm &udp);
+    void finishSeek(UdpComm &udp);
+
+    // Runs readReload() off the event loop; stopped first in the destructor.
+    ReloadQueue reloads;
 };
 
 #endif // PLAYER_H
@@ -1,84 +1,225 @@
 #include "RandomizedSender.h"
+#include "Config.h"
+#include <algorithm>
 #include <iostream>
-#include <cstdlib>
 #include <chrono>
-#include <thread>
 #include <random>
 
-RandomizedSender::RandomizedSender(const std::string &deviceName, const std::string &deviceIp, UdpComm *udp)
-    : deviceName(deviceName), deviceIp(deviceIp), udp(udp), dots_on(false), gen(std::random_device{}())
+RandomizedSender::RandomizedSender(std::shared_ptr<const GeneratorSettings> settings, const std::string &deviceName,
+                                   const std::string &deviceIp, int devicePort, UdpComm *udp, TimerWheel &scheduler,
+                                   uint32_t seed)
+    : settings(std::move(settings)), deviceName(deviceName), deviceIp(deviceIp), devicePort(devicePort),
+      udp(udp), scheduler(scheduler), gen(seed)
 {
-    currentSequenceClipsRemaining = 0;
 }
 
 void RandomizedSender::setOnOff(bool state) {
     std::lock_guard<std::mutex> lock(mutex);
+    if (state == dots_on)
+        return;
     dots_on = state;
-    if (dots_on == false) {
-        sendUdpMessage("STOPCL");
-    }
+    generation++;
+    currentSequenceClipsRemaining = 0;
+    if (dots_on)
+        scheduleWait();
+    else
+        sendUdpMessage(settings->stop_message);
 }
 
-void RandomizedSender::scheduleNext() {
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        if (!dots_on) {
-            return; // Don't proceed if disabled.
-        }
-    }
+bool RandomizedSender::isOn() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dots_on;
+}
+
+void RandomizedSender::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    dots_on = false;
+    generation++;
+}
+
+void RandomizedSender::advance() {
+    std::lock_guard<std::mutex> lock(mutex);
+    sendUdpMessage(settings->stop_message);
+    if (!dots_on)
+        return; // Don't proceed if disabled.
 
     // Check if there are remaining clips in the current sequence.
     if (currentSequenceClipsRemaining > 0) {
-        std::cout << "sequence clips remaining" << currentSequenceClipsRemaining << std::endl;
-        // There are clips remaining in the sequence: play next clip immediately.
-        std::string command = generateRandomCommand();
-        sendUdpMessage(command);
+        std::cout << settings->name << " sequence clips remaining " << currentSequenceClipsRemaining << std::endl;
+        sendUdpMessage(generateRandomCommand());
         currentSequenceClipsRemaining--;
     } else {
-        int waitMillis;
-        {
-            // Guard random engine access with genMutex.
-            std::lock_guard<std::mutex> lock(genMutex);
-            std::uniform_int_distribution<int> waitDist(30000, 170001);
-            waitMillis = waitDist(gen);
-        }
+        // A wait already pending (e.g. a stray ENDP) is replaced by this one.
+        generation++;
+        scheduleWait();
+    }
+}
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(waitMillis));
+void RandomizedSender::scheduleWait() {
+    int waitMillis = randomBetween(settings->wait_min_ms, settings->wait_max_ms);
+    uint64_t expected = generation;
+    std::weak_ptr<RandomizedSender> self = shared_from_this();
+    scheduler.scheduleAfter(std::chrono::milliseconds(waitMillis), [self, expected]() {
+        if (auto sender = self.lock())
+            sender->startSequence(expected);
+    });
+}
 
-        // Generate a new sequence length between 1 and 10.
-        {
-            std::lock_guard<std::mutex> lock(genMutex);
-            std::uniform_int_distribution<int> seqDist(1, 10);
-            currentSequenceClipsRemaining = seqDist(gen);
-        }
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            if (!dots_on) {
-                return; // Don't proceed if disabled.
-            }
+void RandomizedSender::startSequence(uint64_t expected) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!dots_on || generation != expected)
+        return; // Disabled or superseded while waiting.
+    currentSequenceClipsRemaining = randomBetween(settings->length_min, settings->length_max);
+    // Play the first clip of the new sequence.
+    sendUdpMessage(generateRandomCommand());
+    currentSequenceClipsRemaining--;
+}
+
+int RandomizedSender::randomBetween(int lo, int hi) {
+    std::uniform_int_distribution<int> dist(lo, std::max(lo, hi));
+    return dist(gen);
+}
+
+std::string RandomizedSender::generateRandomCommand() {
+    // GeneratorSet::build refuses a generator without clips.
+    int pick = randomBetween(0, static_cast<int>(settings->clips.size()) - 1);
+    return settings->play_command + " " + settings->clips[pick];
+}
+
+void RandomizedSender::sendUdpMessage(const std::string &command) {
+    std::cout << "Sending to " << deviceName << " (" << deviceIp << "): " << command << std::endl;
+    udp->sendUdpMessage(command, deviceIp, devicePort ? devicePort : udp->getSendPort());
+}
+
+void GeneratorSet::dispatch(const std::string &msg, const std::string &senderName) const {
+    auto it = rules.find(msg);
+    if (it == rules.end())
+        return;
+    for (const Rule &rule : it->second) {
+        if (!rule.fromDevice.empty() && rule.fromDevice != senderName)
+            continue;
+        for (uint32_t i = rule.first; i < rule.first + rule.count; i++) {
+            if (rule.op == Op::Advance)
+                senders[i]->advance();
+            else
+                senders[i]->setOnOff(rule.op == Op::Enable);
         }
-        // Play the first clip of the new sequence.
-        std::string command = generateRandomCommand();
-        sendUdpMessage(command);
-        currentSequenceClipsRemaining--;
     }
 }
 
+void GeneratorSet::start() const {
+    for (size_t i = 0; i < senders.size(); i++)
+        if (onAtStart[i])
+            senders[i]->setOnOff(true);
+}
 
-std::string RandomizedSender::generateRandomCommand() {
-    char randomChar;
-    {
-        // Guard generator when picking a random command.
-        std::lock_guard<std::mutex> lock(genMutex);
-        std::uniform_int_distribution<int> dis(0, 22);
-        randomChar = 'a' + dis(gen);
+void GeneratorSet::inheritStates(const GeneratorSet &previous) {
+    std::unordered_map<std::string, bool> states;
+    for (const auto &sender : previous.senders)
+        states[sender->generator() + '\0' + sender->device()] = sender->isOn();
+    for (size_t i = 0; i < senders.size(); i++) {
+        auto it = states.find(senders[i]->generator() + '\0' + senders[i]->device());
+        if (it != states.end())
+            onAtStart[i] = it->second;
     }
-    return "PLAY DOTS-" + std::string(1, randomChar) + ".mp4";
 }
 
+void GeneratorSet::stop() const {
+    for (const auto &sender : senders)
+        sender->cancel();
+}
+
+// One entry of the "generators" array, read in full before any sender is built.
+struct GeneratorDecl {
+    std::shared_ptr<GeneratorSettings> settings = std::make_shared<GeneratorSettings>();
+    std::vector<std::string> devices;
+    std::vector<std::string> advanceOn;
+    struct Trigger {
+        GeneratorSet::Op op;
+        std::string message;
+        std::string fromDevice;
+    };
+    std::vector<Trigger> triggers;
+    bool enabled = true;
+};
 
-void RandomizedSender::sendUdpMessage(const std::string &command) {
-    std::cout << "Sending to " << deviceName << " (" << deviceIp << "): " << command << std::endl;
-    // Use the provided UDP instance's sendPort.
-    udp->sendUdpMessage(command, deviceIp, udp->getSendPort());
+// Clips and timing are checked by readRandomClips, as for a player's random
+// profile; a generator that fails is skipped by build().
+static bool readGenerator(const json &g, GeneratorDecl &decl, std::string &error) {
+    if (!g.is_object()) {
+        error = "not an object";
+        return false;
+    }
+    GeneratorSettings &settings = *decl.settings;
+    settings.name = g.value("name", "generator");
+    if (!readRandomClips(g, settings.clips, settings.wait_min_ms, settings.wait_max_ms, settings.length_min,
+                         settings.length_max, error))
+        return false;
+    settings.play_command = g.value("play_command", settings.play_command);
+    settings.stop_message = g.value("stop_message", settings.stop_message);
+    decl.devices = g.value("devices", std::vector<std::string>());
+    decl.advanceOn = g.value("advance_on", std::vector<std::string>());
+    for (const char *key : {"enable_on", "disable_on"}) {
+        if (!g.contains(key) || !g[key].is_array())
+            continue;
+        GeneratorSet::Op op = key[0] == 'e' ? GeneratorSet::Op::Enable : GeneratorSet::Op::Disable;
+        for (const auto &trigger : g[key])
+            decl.triggers.push_back({op, trigger.value("message", ""), trigger.value("from_device", "")});
+    }
+    decl.enabled = g.value("enabled", true);
+    return true;
+}
+
+std::shared_ptr<GeneratorSet> GeneratorSet::build(const json &generators, const CueTable &table, UdpComm *udp,
+                                                  TimerWheel &scheduler, uint32_t seed) {
+    auto set = std::make_shared<GeneratorSet>();
+    if (!generators.is_array())
+        return set;
+
+    // { "name": "dots", "devices": ["BS1", "BS2"], "clips": [...], "wait_ms": [30000, 170000],
+    //   "sequence_length": [1, 10], "enabled": true, "advance_on": ["ENDP"],
+    //   "enable_on": [{"message": "EOF", "from_device": "VIDEOPC2"}], "disable_on": [...] }
+    for (const auto &g : generators) {
+        GeneratorDecl decl;
+        std::string error;
+        bool valid;
+        try {
+            valid = readGenerator(g, decl, error);
+        } catch (const json::exception &e) {
+            valid = false;
+            error = e.what();
+        }
+        if (!valid) {
+            std::cout << "Generator " << decl.settings->name << " rejected: " << error << std::endl;
+            continue;
+        }
+        std::shared_ptr<const GeneratorSettings> settings = decl.settings;
+
+        uint32_t first = static_cast<uint32_t>(set->senders.size());
+        for (const auto &name : decl.devices) {
+            auto id = table.deviceIds.find(name);
+            if (id == table.deviceIds.end() || table.deviceIps[id->second].empty()) {
+                std::cout << "Generator " << settings->name << ": device " << name
+                          << " not found in devices list." << std::endl;
+                continue;
+            }
+            uint32_t senderSeed = seed + static_cast<uint32_t>(set->senders.size());
+            set->senders.push_back(std::make_shared<RandomizedSender>(settings, name, table.deviceIps[id->second],
+                                                                      table.devicePorts[id->second], udp, scheduler,
+                                                                      senderSeed));
+        }
+        uint32_t count = static_cast<uint32_t>(set->senders.size()) - first;
+        std::cout << "Initialized generator " << settings->name << " on " << count << " devices" << std::endl;
+        if (count == 0)
+            continue;
+
+        // Advance messages only count from the device the sender drives.
+        for (const auto &msg : decl.advanceOn)
+            for (uint32_t i = first; i < first + count; i++)
+                set->rules[msg].push_back({i, 1, Op::Advance, set->senders[i]->device()});
+        for (const auto &trigger : decl.triggers)
+            set->rules[trigger.message].push_back({first, count, trigger.op, trigger.fromDevice});
+        set->onAtStart.resize(set->senders.size(), decl.enabled);
+    }
+    return set;
 }
@@ -1,33 +1,110 @@
 #ifndef RANDOMIZEDSENDER_H
 #define RANDOMIZEDSENDER_H
 
+#include <memory>
 #include <string>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "UdpComm.h"  // Added to bring in the full definition of UdpComm
+#include "TimerWheel.h"
+#include "CueTable.h"
+#include "json.hpp"
 #include <random>
 
-class RandomizedSender {
+using json = nlohmann::json;
+
+// Timing and clip pool of a generator, shared by all of its devices.
+struct GeneratorSettings {
+    std::string name;
+    std::vector<std::string> clips;
+    int wait_min_ms = 30000;
+    int wait_max_ms = 170000;
+    int length_min = 1;
+    int length_max = 10;
+    std::string play_command = "PLAY";   // Sent as "<play_command> <clip>".
+    std::string stop_message = "STOPCL"; // Sent on advance and when disabled.
+};
+
+// Plays random sequences of clips on one device: wait a random time, then
+// play a random number of clips, one per advance (the device's ENDP). All
+// waiting is done by timers on the controller's scheduler, never by a thread.
+class RandomizedSender : public std::enable_shared_from_this<RandomizedSender> {
 public:
-    // Updated constructor with correct parameter types.
-    RandomizedSender(const std::string &deviceName, const std::string &deviceIp, UdpComm *udp);
+    RandomizedSender(std::shared_ptr<const GeneratorSettings> settings, const std::string &deviceName,
+                     const std::string &deviceIp, int devicePort, UdpComm *udp, TimerWheel &scheduler,
+                     uint32_t seed);
 
+    // Turning on starts a wait; turning off cancels it and sends the stop message.
     void setOnOff(bool state);
-    void scheduleNext();
-    std::string generateRandomCommand();
-    int currentSequenceClipsRemaining;
+    // Sends the stop message, then plays the next clip of the sequence or starts a new wait.
+    void advance();
+    // Turns off silently, dropping any pending wait.
+    void cancel();
+
+    const std::string &device() const { return deviceName; }
+    const std::string &generator() const { return settings->name; }
+    // Whether the sender is switched on (waiting or playing).
+    bool isOn();
     void sendUdpMessage(const std::string &command);
 
 private:
+    std::shared_ptr<const GeneratorSettings> settings;
     std::string deviceName;
     std::string deviceIp;
+    int devicePort;
     UdpComm* udp;
-    bool dots_on;
-    std::mutex mutex;
-    std::mutex genMutex;   // For protecting random engine usage.
+    TimerWheel &scheduler;
+
+    std::mutex mutex;  // Guards everything below; timers and the listener both call in.
+    bool dots_on = false;
+    int currentSequenceClipsRemaining = 0;
+    uint64_t generation = 0;  // Bumped to invalidate a pending wait.
 
-    // Each instance has its own random engine.
+    // Each instance has its own random engine, seeded by the GeneratorSet.
     std::mt19937 gen;
 
+    int randomBetween(int lo, int hi);
+    std::string generateRandomCommand();
+    // Called with the lock held.
+    void scheduleWait();
+    void startSequence(uint64_t expected);
+};
+
+// All generators declared in the config, one RandomizedSender per target
+// device, with their enable/disable/advance triggers indexed by message.
+struct GeneratorSet {
+    std::vector<std::shared_ptr<RandomizedSender>> senders;
+
+    enum class Op { Enable, Disable, Advance };
+    struct Rule {
+        uint32_t first;          // Range in senders.
+        uint32_t count;
+        Op op;
+        std::string fromDevice;  // Empty matches any sender.
+    };
+    std::unordered_map<std::string, std::vector<Rule>> rules;
+
+    // Applies the rules listening for msg from the named sender.
+    void dispatch(const std::string &msg, const std::string &senderName) const;
+    // Switches each sender on whose start state is on.
+    void start() const;
+    // Gives each sender the on/off state of the sender for the same generator
+    // and device in previous, so a reload does not undo an enable_on or
+    // disable_on. Senders new to this set keep their "enabled" state. Call
+    // before previous is stopped.
+    void inheritStates(const GeneratorSet &previous);
+    // Cancels pending waits without sending anything.
+    void stop() const;
+
+    // Builds the generators in a "generators" config array against the table's
+    // devices. Sender i draws from an engine seeded with seed + i, so a set built
+    // from the same config and seed plays the same sequences.
+    static std::shared_ptr<GeneratorSet> build(const json &generators, const CueTable &table, UdpComm *udp,
+                                               TimerWheel &scheduler, uint32_t seed);
+
+private:
+    std::vector<char> onAtStart;  // Per sender: switch on in start().
 };
 
 #endif // RANDOMIZEDSENDER_H
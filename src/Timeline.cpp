@@ -0,0 +1,144 @@
+#include "Timeline.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+Timeline::Timeline(const std::string &name, TimerWheel &scheduler, Fire fire)
+    : name(name), scheduler(scheduler), fire(std::move(fire))
+{
+}
+
+int64_t Timeline::positionMs() const {
+    if (state == State::Running)
+        return std::chrono::duration_cast<std::chrono::milliseconds>(TimerWheel::now() - anchor).count();
+    return pausedAtMs;
+}
+
+void Timeline::moveTo(int64_t positionMs) {
+    generation++;
+    pausedAtMs = std::max<int64_t>(0, positionMs);
+    anchor = TimerWheel::now() - std::chrono::milliseconds(pausedAtMs);
+    // Entries before the new position are skipped, not fired late.
+    next = 0;
+    while (next < compiled.actionCount &&
+           table->actions[compiled.firstAction + next].offsetTicks < static_cast<uint64_t>(pausedAtMs))
+        next++;
+}
+
+void Timeline::start(std::shared_ptr<const CueTable> newTable, const CompiledTimeline &newCompiled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    table = std::move(newTable);
+    compiled = newCompiled;
+    driftMs.assign(compiled.actionCount, NAN);
+    run++;
+    state = State::Running;
+    moveTo(0);
+    std::cout << "timeline " << name << " started" << std::endl;
+    scheduleNext();
+}
+
+void Timeline::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state != State::Running)
+        return;
+    pausedAtMs = positionMs();
+    state = State::Paused;
+    generation++;
+    std::cout << "timeline " << name << " paused at " << pausedAtMs << " ms" << std::endl;
+}
+
+void Timeline::resume() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state != State::Paused)
+        return;
+    state = State::Running;
+    moveTo(pausedAtMs);
+    std::cout << "timeline " << name << " resumed at " << pausedAtMs << " ms" << std::endl;
+    scheduleNext();
+}
+
+void Timeline::seek(int64_t positionMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state == State::Stopped)
+        return;
+    moveTo(positionMs);
+    std::cout << "timeline " << name << " seek to " << pausedAtMs << " ms" << std::endl;
+    if (state == State::Running)
+        scheduleNext();
+}
+
+void Timeline::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state == State::Stopped)
+        return;
+    state = State::Stopped;
+    generation++;
+    std::cout << "timeline " << name << " stopped" << std::endl;
+}
+
+void Timeline::scheduleNext() {
+    if (next >= compiled.actionCount) {
+        pausedAtMs = positionMs();
+        state = State::Stopped;
+        std::cout << "timeline " << name << " finished" << std::endl;
+        return;
+    }
+    auto deadline = anchor + std::chrono::milliseconds(table->actions[compiled.firstAction + next].offsetTicks);
+    uint64_t expected = generation;
+    std::weak_ptr<Timeline> self = shared_from_this();
+    scheduler.schedule(deadline, [self, expected]() {
+        if (auto timeline = self.lock())
+            timeline->fireDue(expected);
+    });
+}
+
+void Timeline::fireDue(uint64_t expected) {
+    struct Due {
+        uint32_t action;
+        Clock::time_point deadline;
+    };
+    std::vector<Due> due;
+    std::shared_ptr<const CueTable> current;
+    uint32_t currentRun;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (generation != expected || state != State::Running)
+            return; // Paused, seeked or stopped since this was scheduled.
+        auto now = TimerWheel::now();
+        // Every entry whose time has come, so entries at one offset go out together.
+        while (next < compiled.actionCount) {
+            uint32_t action = compiled.firstAction + next;
+            auto deadline = anchor + std::chrono::milliseconds(table->actions[action].offsetTicks);
+            if (deadline > now)
+                break;
+            driftMs[next] = std::chrono::duration<double, std::milli>(now - deadline).count();
+            std::cout << "timeline " << name << " #" << next << " at_ms=" << table->actions[action].offsetTicks
+                      << " drift_ms=" << driftMs[next] << std::endl;
+            due.push_back({action, deadline});
+            next++;
+        }
+        current = table;
+        currentRun = run;
+        scheduleNext();
+    }
+    // Outside the lock: an entry may itself control this timeline.
+    for (const Due &d : due)
+        fire(*current, d.action, currentRun, d.deadline);
+}
+
+std::string Timeline::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    static const char *names[] = {"stopped", "running", "paused"};
+    std::string out = "TIMELINE " + name + " " + names[static_cast<int>(state)] +
+                      " pos_ms=" + std::to_string(positionMs()) + " next=" + std::to_string(next) + " drift_ms=[";
+    for (size_t i = 0; i < driftMs.size(); i++) {
+        char value[32];
+        if (std::isnan(driftMs[i]))
+            snprintf(value, sizeof(value), "%s-", i ? "," : "");
+        else
+            snprintf(value, sizeof(value), "%s%.3f", i ? "," : "", driftMs[i]);
+        out += value;
+    }
+    return out + "]";
+}
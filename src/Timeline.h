@@ -0,0 +1,61 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "CueTable.h"
+#include "TimerWheel.h"
+
+// A running timeline: the entries of a CompiledTimeline fired against one
+// anchor time (where position 0 falls) on the scheduler. Pause, resume and
+// seek move the anchor, so every entry keeps an absolute deadline and timing
+// errors never add up along the timeline.
+class Timeline : public std::enable_shared_from_this<Timeline> {
+public:
+    using Clock = TimerWheel::Clock;
+    // Sends entry `action` of the table; run is the timeline's start count.
+    using Fire = std::function<void(const CueTable &table, uint32_t action, uint32_t run, Clock::time_point deadline)>;
+
+    Timeline(const std::string &name, TimerWheel &scheduler, Fire fire);
+
+    // Starts from position 0 (restarting if running) with the table's entries.
+    void start(std::shared_ptr<const CueTable> table, const CompiledTimeline &compiled);
+    void pause();
+    void resume();
+    // Moves to positionMs; a paused timeline stays paused there.
+    void seek(int64_t positionMs);
+    void stop();
+
+    // "TIMELINE <name> <state> pos_ms= next= drift_ms=[...]", drift of each entry's last firing.
+    std::string status();
+
+private:
+    enum class State { Stopped, Running, Paused };
+
+    std::string name;
+    TimerWheel &scheduler;
+    Fire fire;
+
+    std::mutex mutex;  // Guards everything below.
+    State state = State::Stopped;
+    std::shared_ptr<const CueTable> table;
+    CompiledTimeline compiled{};
+    Clock::time_point anchor;     // Position 0 while running.
+    int64_t pausedAtMs = 0;       // Position while paused.
+    uint32_t next = 0;            // First entry not yet fired, relative to compiled.firstAction.
+    uint32_t run = 0;
+    uint64_t generation = 0;      // Bumped to drop timers scheduled before a pause, seek or stop.
+    std::vector<double> driftMs;  // Per entry; NaN until fired.
+
+    // Called with the lock held.
+    int64_t positionMs() const;
+    void moveTo(int64_t positionMs);
+    void scheduleNext();
+    void fireDue(uint64_t expected);
+};
+
+#endif // TIMELINE_H
@@ -0,0 +1,203 @@
+#include "TimerWheel.h"
+#include <algorithm>
+#include <cstdio>
+
+std::atomic<int64_t> TimerWheel::virtualNs{TimerWheel::REAL_TIME};
+std::atomic<int64_t> TimerWheel::wallOffsetNs{0};
+
+TimerWheel::TimerWheel(size_t slotCount)
+    : slots(slotCount), origin(now())
+{
+}
+
+TimerWheel::Clock::time_point TimerWheel::now() {
+    int64_t ns = virtualNs.load(std::memory_order_acquire);
+    if (ns == REAL_TIME)
+        return Clock::now();
+    return Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(ns)));
+}
+
+std::time_t TimerWheel::wallNow() {
+    int64_t ns = virtualNs.load(std::memory_order_acquire);
+    if (ns == REAL_TIME)
+        return std::time(nullptr);
+    return static_cast<std::time_t>((ns + wallOffsetNs.load(std::memory_order_relaxed)) / 1000000000);
+}
+
+void TimerWheel::useVirtualTime(Clock::time_point steady, std::time_t wall) {
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(steady.time_since_epoch()).count();
+    wallOffsetNs.store(static_cast<int64_t>(wall) * 1000000000 - ns, std::memory_order_relaxed);
+    virtualNs.store(ns, std::memory_order_release);
+}
+
+void TimerWheel::moveVirtualTime(Clock::time_point t) {
+    virtualNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count(),
+                    std::memory_order_release);
+}
+
+TimerWheel::~TimerWheel() {
+    stop();
+}
+
+void TimerWheel::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running || virtualTime())
+        return;
+    running = true;
+    thread = std::thread(&TimerWheel::run, this);
+}
+
+void TimerWheel::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        running = false;
+    }
+    wake.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+uint64_t TimerWheel::tickOf(Clock::time_point t) const {
+    if (t <= origin)
+        return 0;
+    // Round up so a timer never fires before its deadline.
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+    return static_cast<uint64_t>((us + 999) / 1000);
+}
+
+void TimerWheel::schedule(Clock::time_point deadline, Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Deadlines already passed go into the next tick to be processed.
+        uint64_t tick = std::max(tickOf(deadline), currentTick + 1);
+        slots[tick % slots.size()].push_back({tick, deadline, std::move(task)});
+        pending++;
+        if (tick >= nextDueTick)
+            return;
+        nextDueTick = tick;
+    }
+    wake.notify_one();
+}
+
+uint64_t TimerWheel::findNextDueTick() const {
+    if (pending == 0)
+        return UINT64_MAX;
+    // Walk forward and stop at the first slot holding a timer due in this
+    // revolution. Timers further out are looked for again one revolution on.
+    for (uint64_t tick = currentTick + 1; tick <= currentTick + slots.size(); tick++) {
+        for (const auto &e : slots[tick % slots.size()])
+            if (e.tick == tick)
+                return tick;
+    }
+    return currentTick + slots.size();
+}
+
+void TimerWheel::run() {
+    std::vector<Entry> due;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        if (nextDueTick == UINT64_MAX) {
+            wake.wait(lock);
+            continue;
+        }
+        Clock::time_point wakeAt = origin + std::chrono::milliseconds(nextDueTick);
+        if (Clock::now() < wakeAt) {
+            wake.wait_until(lock, wakeAt);
+            continue;
+        }
+
+        // Walk every tick up to now; each slot is visited once per revolution.
+        uint64_t nowTick = tickOf(Clock::now());
+        uint64_t first = currentTick + 1;
+        uint64_t last = std::min(nowTick, currentTick + slots.size());
+        for (uint64_t tick = first; tick <= last; tick++) {
+            auto &slot = slots[tick % slots.size()];
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].tick <= nowTick) {
+                    due.push_back(std::move(slot[i]));
+                    slot[i] = std::move(slot.back());
+                    slot.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+        currentTick = nowTick;
+        pending -= due.size();
+        nextDueTick = findNextDueTick();
+
+        lock.unlock();
+        fire(due);
+        lock.lock();
+    }
+}
+
+void TimerWheel::fire(std::vector<Entry> &due) {
+    std::sort(due.begin(), due.end(), [](const Entry &a, const Entry &b) { return a.deadline < b.deadline; });
+    for (auto &e : due) {
+        double lateMs = std::chrono::duration<double, std::milli>(now() - e.deadline).count();
+        e.task();
+        std::lock_guard<std::mutex> statsLock(mutex);
+        fired++;
+        totalLateMs += lateMs;
+        maxLateMs = std::max(maxLateMs, lateMs);
+    }
+    due.clear();
+}
+
+void TimerWheel::advanceTo(Clock::time_point t) {
+    // Whole ticks only: the rest of t's tick comes up in the next call, as
+    // it would on the scheduler thread.
+    uint64_t last = t > origin ? std::chrono::duration_cast<std::chrono::milliseconds>(t - origin).count() : 0;
+    std::vector<Entry> due;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (currentTick < last) {
+        if (pending == 0) {
+            currentTick = last;
+            break;
+        }
+        uint64_t tick = ++currentTick;
+        auto &slot = slots[tick % slots.size()];
+        for (size_t i = 0; i < slot.size();) {
+            if (slot[i].tick == tick) {
+                due.push_back(std::move(slot[i]));
+                slot[i] = std::move(slot.back());
+                slot.pop_back();
+            } else {
+                i++;
+            }
+        }
+        if (due.empty())
+            continue;
+        pending -= due.size();
+        lock.unlock();
+        // Timers see the time of their tick, and schedule from it.
+        moveVirtualTime(origin + std::chrono::milliseconds(tick));
+        fire(due);
+        lock.lock();
+    }
+    lock.unlock();
+    if (t > now())
+        moveVirtualTime(t);
+}
+
+TimerWheel::Stats TimerWheel::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats s;
+    s.fired = fired;
+    s.pending = pending;
+    s.meanLateMs = fired ? totalLateMs / fired : 0.0;
+    s.maxLateMs = maxLateMs;
+    return s;
+}
+
+std::string TimerWheel::report() {
+    Stats s = stats();
+    char line[160];
+    snprintf(line, sizeof(line), "timers fired=%llu pending=%llu late_mean_ms=%.3f late_max_ms=%.3f",
+             static_cast<unsigned long long>(s.fired), static_cast<unsigned long long>(s.pending),
+             s.meanLateMs, s.maxLateMs);
+    return line;
+}
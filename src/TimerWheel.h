@@ -0,0 +1,94 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hashed timer wheel served by a single scheduler thread. Deadlines are
+// absolute steady_clock times, rounded up to 1 ms ticks; timers further out
+// than one revolution stay in their slot until their round comes up.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Task = std::function<void()>;
+
+    explicit TimerWheel(size_t slotCount = 1024);
+    ~TimerWheel();
+
+    void start();
+    void stop();
+
+    // Runs task on the scheduler thread once deadline has passed.
+    void schedule(Clock::time_point deadline, Task task);
+    void scheduleAfter(std::chrono::milliseconds delay, Task task) {
+        schedule(now() + delay, std::move(task));
+    }
+
+    // The controller's time: the steady and system clocks, unless the replay
+    // tool has pinned both to recorded time with useVirtualTime(). Virtual
+    // time only moves in advanceTo(), and no scheduler thread is started.
+    static Clock::time_point now();
+    static std::time_t wallNow();
+    static void useVirtualTime(Clock::time_point steady, std::time_t wall);
+    static bool virtualTime() { return virtualNs.load(std::memory_order_acquire) != REAL_TIME; }
+
+    // Virtual time only: runs every timer due by t on the caller's thread,
+    // tick by tick in deadline order, as the scheduler thread would have.
+    void advanceTo(Clock::time_point t);
+
+    // How late timers fired relative to their deadline.
+    struct Stats {
+        uint64_t fired = 0;
+        uint64_t pending = 0;
+        double meanLateMs = 0.0;
+        double maxLateMs = 0.0;
+    };
+    Stats stats();
+    std::string report();
+
+private:
+    struct Entry {
+        uint64_t tick;
+        Clock::time_point deadline;
+        Task task;
+    };
+
+    std::vector<std::vector<Entry>> slots;
+    Clock::time_point origin;    // Tick 0.
+    uint64_t currentTick = 0;    // Last tick processed.
+    uint64_t nextDueTick = UINT64_MAX;
+    uint64_t pending = 0;
+
+    uint64_t fired = 0;
+    double totalLateMs = 0.0;
+    double maxLateMs = 0.0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool running = false;
+
+    static constexpr int64_t REAL_TIME = INT64_MIN;
+    static std::atomic<int64_t> virtualNs;      // Steady clock, REAL_TIME when off.
+    static std::atomic<int64_t> wallOffsetNs;   // Wall clock minus virtualNs.
+    static void moveVirtualTime(Clock::time_point t);  // The wall clock moves along.
+
+    uint64_t tickOf(Clock::time_point t) const;
+    // Fires due in deadline order and adds them to the stats.
+    void fire(std::vector<Entry> &due);
+    void run();
+    // Tick the scheduler wakes for next: the first due tick within one
+    // revolution, else the end of the revolution. Called with the lock held
+    // after timers fire; costs at most the slots up to that tick.
+    uint64_t findNextDueTick() const;
+};
+
+#endif // TIMERWHEEL_H
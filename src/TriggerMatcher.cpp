@@ -0,0 +1,120 @@
+#include "TriggerMatcher.h"
+#include <algorithm>
+
+static const uint32_t NO_NODE = UINT32_MAX;
+
+bool TriggerMatcher::parseKind(const std::string &name, Kind &kind) {
+    if (name.empty() || name == "exact")
+        kind = Kind::Exact;
+    else if (name == "prefix")
+        kind = Kind::Prefix;
+    else if (name == "glob")
+        kind = Kind::Glob;
+    else if (name == "regex")
+        kind = Kind::Regex;
+    else
+        return false;
+    return true;
+}
+
+bool TriggerMatcher::globMatch(const char *pattern, const char *text) {
+    // Iterative match with single-star backtracking.
+    const char *star = nullptr;
+    const char *resume = nullptr;
+    while (*text) {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == '?' || *pattern == *text) {
+            pattern++;
+            text++;
+        } else if (star) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+uint32_t TriggerMatcher::child(uint32_t node, char c) const {
+    const auto &next = nodes[node].next;
+    auto it = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0u),
+                               [](const std::pair<char, uint32_t> &a, const std::pair<char, uint32_t> &b) {
+                                   return a.first < b.first;
+                               });
+    return it != next.end() && it->first == c ? it->second : NO_NODE;
+}
+
+uint32_t TriggerMatcher::insert(const std::string &literal) {
+    uint32_t node = 0;
+    for (char c : literal) {
+        uint32_t found = child(node, c);
+        if (found == NO_NODE) {
+            found = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+            auto &next = nodes[node].next;
+            next.insert(std::upper_bound(next.begin(), next.end(), std::make_pair(c, 0u),
+                                         [](const std::pair<char, uint32_t> &a, const std::pair<char, uint32_t> &b) {
+                                             return a.first < b.first;
+                                         }),
+                        {c, found});
+        }
+        node = found;
+    }
+    return node;
+}
+
+uint32_t TriggerMatcher::add(Kind kind, const std::string &pattern) {
+    std::string key = std::to_string(static_cast<int>(kind)) + pattern;
+    auto known = patternIds.find(key);
+    if (known != patternIds.end())
+        return known->second;
+    uint32_t id = static_cast<uint32_t>(patterns.size());
+    switch (kind) {
+    case Kind::Exact:
+        nodes[insert(pattern)].exact.push_back(id);
+        break;
+    case Kind::Prefix:
+        nodes[insert(pattern)].prefix.push_back(id);
+        break;
+    case Kind::Glob:
+        nodes[insert(pattern.substr(0, pattern.find_first_of("*?")))].globs.push_back(id);
+        break;
+    case Kind::Regex:
+        regexes.push_back({id, std::regex(pattern, std::regex::ECMAScript | std::regex::optimize)});
+        break;
+    }
+    patterns.push_back({kind, pattern});
+    patternIds.emplace(key, id);
+    return id;
+}
+
+void TriggerMatcher::match(const std::string &msg, std::vector<uint32_t> &hits) const {
+    uint32_t node = 0;
+    size_t depth = 0;
+    while (true) {
+        const Node &n = nodes[node];
+        hits.insert(hits.end(), n.prefix.begin(), n.prefix.end());
+        for (uint32_t id : n.globs) {
+            // The literal prefix already matched; check the rest.
+            const std::string &glob = patterns[id].text;
+            if (globMatch(glob.c_str() + depth, msg.c_str() + depth))
+                hits.push_back(id);
+        }
+        if (depth == msg.size()) {
+            hits.insert(hits.end(), n.exact.begin(), n.exact.end());
+            break;
+        }
+        node = child(node, msg[depth++]);
+        if (node == NO_NODE)
+            break;
+    }
+    for (const auto &r : regexes) {
+        if (std::regex_match(msg, r.re))
+            hits.push_back(r.id);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef TRIGGERMATCHER_H
+#define TRIGGERMATCHER_H
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Matches a message against every trigger pattern in one pass. Exact and
+// prefix patterns live in a byte trie walked once along the message; globs
+// hang off the trie node of their literal prefix and are only tried when the
+// walk reaches it; regexes are compiled once and tried last. Every pattern
+// must match the whole message, except prefix patterns.
+class TriggerMatcher {
+public:
+    enum class Kind { Exact, Prefix, Glob, Regex };
+
+    // Returns the pattern's id; adding the same pattern twice returns the same
+    // id. Throws std::regex_error for a bad regex.
+    uint32_t add(Kind kind, const std::string &pattern);
+
+    // Appends the ids of all patterns matching msg to hits.
+    void match(const std::string &msg, std::vector<uint32_t> &hits) const;
+
+    size_t patternCount() const { return patterns.size(); }
+
+    // "exact" (default), "prefix", "glob" or "regex"; false if unknown.
+    static bool parseKind(const std::string &name, Kind &kind);
+    // '*' matches any run of characters, '?' any one character.
+    static bool globMatch(const char *pattern, const char *text);
+
+private:
+    struct Node {
+        std::vector<std::pair<char, uint32_t>> next;  // Sorted by character.
+        std::vector<uint32_t> exact;                  // Patterns ending here.
+        std::vector<uint32_t> prefix;                 // Patterns matching anything that starts here.
+        std::vector<uint32_t> globs;                  // Globs whose literal prefix ends here.
+    };
+    struct Pattern {
+        Kind kind;
+        std::string text;
+    };
+    struct CompiledRegex {
+        uint32_t id;
+        std::regex re;
+    };
+
+    std::vector<Node> nodes = std::vector<Node>(1);  // nodes[0] is the root.
+    std::vector<Pattern> patterns;
+    std::unordered_map<std::string, uint32_t> patternIds;  // Kind digit + pattern text.
+    std::vector<CompiledRegex> regexes;
+
+    uint32_t child(uint32_t node, char c) const;
+    uint32_t insert(const std::string &literal);
+};
+
+#endif // TRIGGERMATCHER_H
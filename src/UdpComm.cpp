@@ -1,4 +1,5 @@
 #include "UdpComm.h"
+#include "Journal.h"
 #include <iostream>
 #include <cstring>
 
@@ -18,12 +19,20 @@ typedef long ssize_t;
 #include <errno.h>
 #endif
 
+#ifdef _WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <thread>
 
 UdpComm::UdpComm(int listenPort, int sendPort, const std::string &controllerIp)
-    : m_listenPort(listenPort), m_sendPort(sendPort), m_controllerIp(controllerIp)
+    : m_listenPort(listenPort), m_sendPort(sendPort), m_controllerIp(controllerIp), m_sendSock(-1), m_boundSock(-1)
 {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -31,9 +40,33 @@ UdpComm::UdpComm(int listenPort, int sendPort, const std::string &controllerIp)
         std::cerr << "WSAStartup failed\n";
     }
 #endif
+    m_sendSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_sendSock < 0) {
+        std::cerr << "UdpComm: Failed to create send socket: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    int broadcastEnable = 1;
+    if (setsockopt(m_sendSock, SOL_SOCKET, SO_BROADCAST,
+                   reinterpret_cast<const char*>(&broadcastEnable), sizeof(broadcastEnable)) < 0) {
+        std::cerr << "UdpComm: Failed to set SO_BROADCAST: " << strerror(errno) << std::endl;
+#ifdef _WIN32
+        closesocket(m_sendSock);
+#else
+        close(m_sendSock);
+#endif
+        m_sendSock = -1;
+    }
 }
 
 UdpComm::~UdpComm() {
+    if (m_sendSock >= 0) {
+#ifdef _WIN32
+        closesocket(m_sendSock);
+#else
+        close(m_sendSock);
+#endif
+    }
 #ifdef _WIN32
     WSACleanup();
 #endif
@@ -43,83 +76,115 @@ int UdpComm::getSendPort() {
     return m_sendPort;
 }
 
-void UdpComm::sendLog(const std::string &msg) {
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
-        std::cerr << "UdpComm: Failed to create socket for sending logs: " << strerror(errno) << std::endl;
-        return;
+struct UdpComm::SendSocket {
+    // The count goes up before the bound socket is read, so once remove() has
+    // swapped it out and seen no sends in flight, none can still hold it.
+    explicit SendSocket(UdpComm &comm) : comm(comm) {
+        comm.m_sendsInFlight++;
+        int bound = comm.m_boundSock.load();
+        sock = bound >= 0 ? bound : comm.m_sendSock;
     }
+    ~SendSocket() { comm.m_sendsInFlight--; }
+    UdpComm &comm;
+    int sock;
+};
 
-    int broadcastEnable = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST,
-                   reinterpret_cast<const char*>(&broadcastEnable), sizeof(broadcastEnable)) < 0) {
-        std::cerr << "UdpComm: Failed to set SO_BROADCAST: " << strerror(errno) << std::endl;
-#ifdef _WIN32
-        closesocket(sock);
-#else
-        close(sock);
-#endif
-        return;
-    }
+static std::atomic<bool> dryRunMode{false};
+
+void UdpComm::setDryRun(bool dryRun) {
+    dryRunMode = dryRun;
+}
 
+void UdpComm::sendTo(const std::string &msg, const std::string &destIp, int destPort, const char *what) {
     sockaddr_in destAddr{};
     destAddr.sin_family = AF_INET;
-    destAddr.sin_port = htons(m_sendPort);
-    destAddr.sin_addr.s_addr = inet_addr(m_controllerIp.c_str());
+    destAddr.sin_port = htons(destPort);
+    destAddr.sin_addr.s_addr = inet_addr(destIp.c_str());
+
+    if (Journal *journal = Journal::active())
+        journal->append(Journal::OUT, static_cast<uint16_t>(m_listenPort), destAddr.sin_addr.s_addr,
+                        static_cast<uint16_t>(destPort), msg.data(), msg.size());
+    if (dryRunMode)
+        return;
 
+    SendSocket send(*this);
+    int sock = send.sock;
+    if (sock < 0) {
+        std::cerr << "UdpComm: No socket for sending " << what << std::endl;
+        return;
+    }
+
+    // sendto on a datagram socket is atomic, so concurrent senders can share it.
     ssize_t sent = sendto(sock, msg.c_str(), msg.size(), 0,
                           reinterpret_cast<sockaddr*>(&destAddr), sizeof(destAddr));
     if (sent < 0)
-        std::cerr << "UdpComm: Error sending log: " << strerror(errno) << std::endl;
-
-#ifdef _WIN32
-    closesocket(sock);
-#else
-    close(sock);
-#endif
+        std::cerr << "UdpComm: Error sending " << what << ": " << strerror(errno) << std::endl;
 }
 
-void UdpComm::sendUdpMessage(const std::string &msg, const std::string &destIp, int destPort) {
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+void UdpComm::sendBatch(const std::string &msg, const sockaddr_in *dests, size_t count) {
+    if (Journal *journal = Journal::active()) {
+        for (size_t i = 0; i < count; i++)
+            journal->append(Journal::OUT, static_cast<uint16_t>(m_listenPort), dests[i].sin_addr.s_addr,
+                            ntohs(dests[i].sin_port), msg.data(), msg.size());
+    }
+    if (dryRunMode || count == 0)
+        return;
+
+    SendSocket send(*this);
+    int sock = send.sock;
     if (sock < 0) {
-        std::cerr << "UdpComm: Failed to create socket for sending UDP message: " << strerror(errno) << std::endl;
+        std::cerr << "UdpComm: No socket for sending batch" << std::endl;
         return;
     }
 
-    int broadcastEnable = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST,
-                   reinterpret_cast<const char*>(&broadcastEnable), sizeof(broadcastEnable)) < 0) {
-        std::cerr << "UdpComm: Failed to set SO_BROADCAST: " << strerror(errno) << std::endl;
-#ifdef _WIN32
-        closesocket(sock);
+#ifdef __linux__
+    // All datagrams share the payload; only the destination differs.
+    static constexpr size_t BATCH = 64;
+    iovec iov{const_cast<char *>(msg.data()), msg.size()};
+    mmsghdr headers[BATCH];
+    size_t done = 0;
+    while (done < count) {
+        size_t n = std::min(BATCH, count - done);
+        for (size_t i = 0; i < n; i++) {
+            headers[i] = mmsghdr{};
+            headers[i].msg_hdr.msg_name = const_cast<sockaddr_in *>(&dests[done + i]);
+            headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            headers[i].msg_hdr.msg_iov = &iov;
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = sendmmsg(sock, headers, static_cast<unsigned>(n), 0);
+        if (sent < 0) {
+            // The first datagram failed; report it and carry on with the rest.
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &dests[done].sin_addr, ip, sizeof(ip));
+            std::cerr << "UdpComm: Error sending batch to " << ip << ": " << strerror(errno) << std::endl;
+            sent = 1;
+        }
+        done += static_cast<size_t>(sent);
+    }
 #else
-        close(sock);
-#endif
-        return;
+    for (size_t i = 0; i < count; i++) {
+        ssize_t sent = sendto(sock, msg.c_str(), static_cast<int>(msg.size()), 0,
+                              reinterpret_cast<const sockaddr*>(&dests[i]), sizeof(sockaddr_in));
+        if (sent < 0)
+            std::cerr << "UdpComm: Error sending batch: " << strerror(errno) << std::endl;
     }
+#endif
+}
 
-    sockaddr_in destAddr{};
-    destAddr.sin_family = AF_INET;
-    destAddr.sin_port = htons(destPort);
-    destAddr.sin_addr.s_addr = inet_addr(destIp.c_str());
-
-    ssize_t sent = sendto(sock, msg.c_str(), msg.size(), 0,
-                          reinterpret_cast<sockaddr*>(&destAddr), sizeof(destAddr));
-    if (sent < 0)
-        std::cerr << "UdpComm: Error sending UDP message: " << strerror(errno) << std::endl;
+void UdpComm::sendLog(const std::string &msg) {
+    sendTo(msg, m_controllerIp, m_sendPort, "log");
+}
 
-#ifdef _WIN32
-    closesocket(sock);
-#else
-    close(sock);
-#endif
+void UdpComm::sendUdpMessage(const std::string &msg, const std::string &destIp, int destPort) {
+    sendTo(msg, destIp, destPort, "UDP message");
 }
 
-void UdpComm::runListener(const std::function<void(const std::string&, const sockaddr_in&, socklen_t)>& handler) {
+int UdpComm::openListenSocket() {
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
         sendLog("UdpComm: Error creating UDP socket: " + std::string(strerror(errno)));
-        return;
+        return -1;
     }
 
     int reuse = 1;
@@ -140,28 +205,42 @@ void UdpComm::runListener(const std::function<void(const std::string&, const soc
 #else
         close(sockfd);
 #endif
-        return;
+        return -1;
     }
+    return sockfd;
+}
 
+// Reads one datagram and passes it, without trailing line endings, to handler.
+static void receiveOne(int sockfd, const UdpComm::Handler &handler, UdpComm &comm) {
     char buffer[1024];
-    while (true) {
-        sockaddr_in src{};
-        socklen_t srcLen = sizeof(src);
-        ssize_t bytes = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0,
-                                 reinterpret_cast<sockaddr*>(&src), &srcLen);
-        if (bytes < 0) {
-            sendLog("UdpComm: Error receiving UDP data: " + std::string(strerror(errno)));
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            continue;
-        }
-        if (bytes > 0) {
-            buffer[bytes] = '\0';
-            std::string command(buffer);
-            while (!command.empty() && (command.back() == '\n' || command.back() == '\r'))
-                command.pop_back();
-            handler(command, src, srcLen);
-        }
+    sockaddr_in src{};
+    socklen_t srcLen = sizeof(src);
+    ssize_t bytes = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0,
+                             reinterpret_cast<sockaddr*>(&src), &srcLen);
+    if (bytes < 0) {
+        comm.sendLog("UdpComm: Error receiving UDP data: " + std::string(strerror(errno)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return;
+    }
+    if (bytes > 0) {
+        if (Journal *journal = Journal::active())
+            journal->append(Journal::IN, static_cast<uint16_t>(comm.getListenPort()), src.sin_addr.s_addr,
+                            ntohs(src.sin_port), buffer, static_cast<size_t>(bytes));
+        buffer[bytes] = '\0';
+        std::string command(buffer);
+        while (!command.empty() && (command.back() == '\n' || command.back() == '\r'))
+            command.pop_back();
+        handler(command, src, srcLen);
     }
+}
+
+void UdpComm::runListener(const Handler& handler) {
+    int sockfd = openListenSocket();
+    if (sockfd < 0)
+        return;
+
+    while (true)
+        receiveOne(sockfd, handler, *this);
 
 #ifdef _WIN32
     closesocket(sockfd);
@@ -169,3 +248,92 @@ void UdpComm::runListener(const std::function<void(const std::string&, const soc
     close(sockfd);
 #endif
 }
+
+bool UdpReactor::add(UdpComm &comm, UdpComm::Handler handler) {
+    int sockfd = comm.openListenSocket();
+    if (sockfd < 0)
+        return false;
+
+    // Replies leave from the listen port, so the controller can tell
+    // several players on the same host apart by source port.
+    int broadcastEnable = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST,
+                   reinterpret_cast<const char*>(&broadcastEnable), sizeof(broadcastEnable)) == 0)
+        comm.m_boundSock = sockfd;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back({sockfd, &comm, std::move(handler)});
+    generation++;
+    return true;
+}
+
+void UdpReactor::remove(UdpComm &comm) {
+    int sockfd = -1;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry &e) { return e.comm == &comm; });
+        if (it == entries.end())
+            return;
+        sockfd = it->sock;
+        entries.erase(it);
+        generation++;
+        // A pass in progress may still hold comm; the next one will not.
+        if (inPass) {
+            uint64_t seen = passes;
+            passDone.wait(lock, [&] { return passes != seen; });
+        }
+    }
+    // Sends switch back to the unbound socket; the last one still on the
+    // listen socket finishes before it is closed.
+    comm.m_boundSock.store(-1);
+    while (comm.m_sendsInFlight.load() != 0)
+        std::this_thread::yield();
+#ifdef _WIN32
+    closesocket(sockfd);
+#else
+    close(sockfd);
+#endif
+}
+
+void UdpReactor::run() {
+    // The snapshot is only rebuilt when add() or remove() changed the entries,
+    // not on every pass. poll() has no FD_SETSIZE limit on descriptor numbers.
+    std::vector<Entry> current;
+    std::vector<pollfd> fds;
+    uint64_t seenGeneration = 0;
+    bool haveSnapshot = false;
+    while (true) {
+        {
+            // Sockets may be added while running; they are picked up on the next pass.
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!haveSnapshot || generation != seenGeneration) {
+                current = entries;
+                seenGeneration = generation;
+                haveSnapshot = true;
+                fds.assign(current.size(), pollfd{});
+                for (size_t i = 0; i < current.size(); i++) {
+                    fds[i].fd = current[i].sock;
+                    fds[i].events = POLLIN;
+                }
+            }
+            inPass = true;
+        }
+
+        int ready = poll(fds.data(), static_cast<unsigned long>(fds.size()), 250);
+        if (ready < 0) {
+            std::cerr << "UdpReactor: poll failed: " << strerror(errno) << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        } else if (ready > 0) {
+            for (size_t i = 0; i < current.size(); i++) {
+                if (fds[i].revents & POLLIN)
+                    receiveOne(current[i].sock, current[i].handler, *current[i].comm);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inPass = false;
+            passes++;
+        }
+        passDone.notify_all();
+    }
+}
@@ -2,7 +2,12 @@
 #define UDP_COMM_H
 
 #include <string>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -16,6 +21,8 @@
 #endif
 class UdpComm {
 public:
+    using Handler = std::function<void(const std::string&, const struct sockaddr_in&, socklen_t)>;
+
     // Constructor and destructor.
     UdpComm(int listenPort, int sendPort, const std::string &controllerIp);
     ~UdpComm();
@@ -26,16 +33,65 @@ public:
     // Sends a UDP message to the specified destination IP and port.
     void sendUdpMessage(const std::string &msg, const std::string &destIp, int destPort);
 
+    // Sends one message to count prebuilt addresses. On Linux this is one
+    // sendmmsg call per 64 datagrams; elsewhere it loops over sendto.
+    void sendBatch(const std::string &msg, const sockaddr_in *dests, size_t count);
+
     // Runs the UDP listener, calling the provided callback for each received message.
     // The callback receives the received message, the source sockaddr_in and its length.
-    void runListener(const std::function<void(const std::string&, const struct sockaddr_in&, socklen_t)>& handler);
+    void runListener(const Handler& handler);
 
     int getSendPort();
+    int getListenPort() const { return m_listenPort; }
+
+    // In dry-run mode nothing is put on the wire; sends are still journaled.
+    // Used by the replay tool.
+    static void setDryRun(bool dryRun);
 
 private:
     int m_listenPort;
     int m_sendPort;
     std::string m_controllerIp;
+    int m_sendSock;  // Shared by all sends; created once instead of per datagram.
+    std::atomic<int> m_boundSock; // Listen socket owned by a UdpReactor; used for sends when set.
+    std::atomic<int> m_sendsInFlight{0};  // Sends that may be using m_boundSock.
+
+    // Picks the socket for one send and counts it in flight until destroyed.
+    struct SendSocket;
+
+    friend class UdpReactor;
+    // Creates a UDP socket bound to the listen port, or -1.
+    int openListenSocket();
+    void sendTo(const std::string &msg, const std::string &destIp, int destPort, const char *what);
+};
+
+// Serves the listen ports of several UdpComm instances from a single thread.
+class UdpReactor {
+public:
+    // Binds comm's listen port and routes its datagrams to handler. Messages
+    // sent through comm afterwards leave from that port.
+    bool add(UdpComm &comm, UdpComm::Handler handler);
+    // Unregisters comm and closes its listen socket. Returns once the reactor
+    // thread no longer uses comm or its handler, so both may then be destroyed,
+    // and once no send on comm is still using the socket.
+    // Not to be called from a handler.
+    void remove(UdpComm &comm);
+
+    // Poll loop; never returns.
+    void run();
+
+private:
+    struct Entry {
+        int sock;
+        UdpComm *comm;
+        UdpComm::Handler handler;
+    };
+    std::mutex mutex;
+    std::condition_variable passDone;
+    std::vector<Entry> entries;
+    bool inPass = false;   // The reactor thread is polling or handling a snapshot of entries.
+    uint64_t passes = 0;   // Passes finished.
+    uint64_t generation = 0;  // Bumped by add() and remove(); run() re-snapshots when it changes.
 };
 
 #endif // UDP_COMM_H
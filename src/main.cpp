@@ -1,7 +1,12 @@
+#include <atomic>
+#include <csignal>
+#include <ctime>
 #include <iostream>
-#include <fstream>
+#include <memory>
+#include <random>
 #include <string>
 #include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -15,10 +20,39 @@
 
 #include "Player.h"
 #include "Controller.h"
+#include "Config.h"
+#include "Journal.h"
 #include "json.hpp"
 
 using json = nlohmann::json;
 
+static std::atomic<bool> reloadRequested(false);
+
+#ifndef _WIN32
+static void onSighup(int)
+{
+    reloadRequested = true;
+}
+#endif
+
+// Event journal: { "journal": { "path": "charudp.journal", "size_mb": 16 } }
+// The SESSION record carries the generator seed and the wall clock, which a
+// replay needs to reproduce the run.
+static void openJournal(Journal& journal, const json& config, uint32_t randomSeed)
+{
+    if (!config.contains("journal") || !config["journal"].is_object())
+        return;
+    const json& settings = config["journal"];
+    std::string path = settings.value("path", std::string("charudp.journal"));
+    size_t bytes = static_cast<size_t>(settings.value("size_mb", 16)) << 20;
+    if (!journal.open(path, bytes))
+        return;
+    Journal::setActive(&journal);
+    journal.append(Journal::SESSION, "CharUDPMPV started seed=" + std::to_string(randomSeed) +
+                                     " wall=" + std::to_string(std::time(nullptr)));
+    std::cout << "Journaling to " << path << " (" << (bytes >> 20) << " MB ring)" << std::endl;
+}
+
 int main()
 {
 #ifdef _WIN32
@@ -27,49 +61,48 @@ int main()
 #endif
     // --- Read configuration in main ---
     json config;
-    std::ifstream configFile("player.json");
-    if (!configFile)
-    {
-        std::cerr << "Failed to open player.json" << std::endl;
-    }
-    else
-    {
-        try
-        {
-            configFile >> config;
-        }
-        catch (json::parse_error& e)
-        {
-            std::cerr << "JSON parse error: " << e.what() << std::endl;
-        }
-    }
+    readConfigFile(CONFIG_PATH, config);
+
+    // Every datagram in and out, and every cue and action, from here on.
+    uint32_t randomSeed = std::random_device{}();
+    static Journal journal;
+    openJournal(journal, config, randomSeed);
 
     //////////////
     ////Player////
     //////////////
 
-    // Create Player instance.
-    Player player;
-
-    // Update Player's configuration using the JSON keys.
-    if (config.contains("controller_send_port"))
-        player.udp_listen_port = config["controller_send_port"].get<int>();
-    if (config.contains("controller_receive_port"))
-        player.udp_send_port = config["controller_receive_port"].get<int>();
-    if (config.contains("controller_ip"))
-        player.controller_ip = config["controller_ip"].get<std::string>();
-    if (config.contains("use_attract"))
-        player.use_attract = config["use_attract"].get<bool>();
-    if (config.contains("attract_video"))
-        player.attract_video = config["attract_video"].get<std::string>();
-
-    // Optionally, if you want to assign a name to the player:
-    if (config.contains("player_name"))
-        player.player_name = config["player_name"].get<std::string>();
-
-    // Start the player in its own thread.
-    std::thread playerThread(&Player::start, &player);
-    playerThread.detach();
+    // The demuxer cache budget, the keyframe indexes and the UDP reactor are
+    // shared by every player in this process.
+    auto cacheBudget = std::make_shared<CacheBudget>();
+    cacheBudget->configure(config);
+    auto keyframeIndexes = std::make_shared<KeyframeIndexCache>();
+    UdpReactor reactor;
+
+    // A "players" array runs one player per output in this process. Each entry
+    // overrides the top-level player keys (player_name, screen, ports, ...).
+    std::vector<json> configs = playerConfigs(config);
+    std::vector<std::unique_ptr<Player>> players;
+    for (size_t i = 0; i < configs.size(); i++)
+    {
+        auto player = std::make_unique<Player>();
+        player->configure(configs[i]);
+        player->config_index = i;
+        player->cache_budget = cacheBudget;
+        player->keyframe_indexes = keyframeIndexes;
+        player->reactor = &reactor;
+
+        // Start the player in its own thread.
+        std::thread playerThread(&Player::start, player.get());
+        playerThread.detach();
+        players.push_back(std::move(player));
+    }
+    std::cout << "Started " << players.size() << " player(s)" << std::endl;
+
+    // One thread receives commands for all players.
+    std::thread reactorThread(&UdpReactor::run, &reactor);
+    reactorThread.detach();
+
     /////////////////
     // CONTROLLER //
     ///////////////
@@ -78,44 +111,35 @@ int main()
     if (config.contains("is_controller"))
         is_controller = config["is_controller"].get<bool>();
 
-    // In main.cpp
+    std::unique_ptr<Controller> controller;
     if (is_controller)
     {
         std::cout << "Operating as CONTROLLER" << std::endl;
-        Controller controller;
+        controller = std::make_unique<Controller>();
+        controller->random_seed = randomSeed;
+        controller->configure(config);
 
-        // Populate the controller's devices.
-        if (config.contains("devices"))
-        {
-            std::cout << "Configuring devices:" << std::endl;
-            for (auto& item : config["devices"].items())
-            {
-                std::string name = item.key();
-                std::string ip = item.value()["ip"].get<std::string>();
-                controller.devices[name] = ip;
-                std::cout << "  Added device: " << name << " with IP: " << ip << std::endl;
-            }
-        }
-        std::cout << "Total devices configured: " << controller.devices.size() << std::endl;
+        std::thread controllerThread(&Controller::start, controller.get());
+        controllerThread.detach();
+    }
 
-        // Populate the controller's cues.
-        if (config.contains("cues") && config["cues"].is_array())
-        {
-            std::cout << "Loading " << config["cues"].size() << " cues" << std::endl;
-            for (const auto& cue : config["cues"])
-            {
-                controller.cues.push_back(cue);
-            }
-        }
+#ifndef _WIN32
+    // SIGHUP re-reads the config, the same way a RELOAD datagram does.
+    signal(SIGHUP, onSighup);
+#endif
 
-        // Start the controller - IMPORTANT: Use join() instead of detach()
-        std::thread controllerThread(&Controller::start, &controller);
-        controllerThread.join(); //
-    }
     // Keep main alive.
     while (true)
     {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if (reloadRequested.exchange(false))
+        {
+            std::cout << "SIGHUP received, reloading " << CONFIG_PATH << std::endl;
+            for (auto& player : players)
+                player->reload();
+            if (controller)
+                controller->requestReload();
+        }
     }
 
 #ifdef _WIN32
@@ -0,0 +1,300 @@
+// Feeds the datagrams recorded in a journal back into the Controller logic,
+// with the network switched off and the clocks virtual, at recorded or
+// accelerated speed. The output does not depend on the speed.
+//
+//   CharUDPReplay <journal> [--config player.json] [--speed 1] [--out replay.journal] [--dump]
+//
+// --speed 0 replays as fast as possible; --dump prints the journal instead.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Controller.h"
+#include "Config.h"
+#include "Journal.h"
+#include "TimerWheel.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+struct Inbound
+{
+    int64_t atNs;  // On the session timeline below.
+    uint16_t localPort;
+    sockaddr_in src;
+    std::string msg;
+};
+
+// One run of the recorded process: the generator seed and wall clock from
+// its SESSION record, and the datagrams received while it ran.
+struct Session
+{
+    int64_t startNs = 0;  // On the session timeline.
+    int64_t endNs = 0;    // Its last record.
+    bool seeded = false;
+    uint32_t seed = 0;
+    bool hasWall = false;
+    std::time_t wall = 0;
+    std::vector<Inbound> inbound;
+};
+
+// Reads "key=<number>" from a SESSION payload.
+static bool field(const std::string& text, const char* key, unsigned long long& value)
+{
+    size_t at = text.find(std::string(" ") + key + "=");
+    if (at == std::string::npos)
+        return false;
+    const char* digits = text.c_str() + at + strlen(key) + 2;
+    char* end = nullptr;
+    value = std::strtoull(digits, &end, 10);
+    return end != digits;
+}
+
+// Steady timestamps only compare within one session (one run of the
+// process); a restart or a reboot starts a new clock. Each session is timed
+// from its first record and the sessions are laid end to end.
+struct SessionTimeline
+{
+    int64_t base = 0;    // Where the current session starts.
+    int64_t start = -1;  // steadyNs of its first record.
+    int64_t last = 0;    // Where the last record fell.
+    size_t sessions = 0;
+
+    int64_t place(const Journal::Record& rec)
+    {
+        if (rec.type == Journal::SESSION || start < 0)
+        {
+            base = last;
+            start = rec.steadyNs;
+            sessions++;
+        }
+        last = base + std::max<int64_t>(0, rec.steadyNs - start);
+        return last;
+    }
+};
+
+static const char* typeName(uint8_t type)
+{
+    switch (type)
+    {
+    case Journal::SESSION: return "SESSION";
+    case Journal::IN: return "IN";
+    case Journal::OUT: return "OUT";
+    case Journal::CUE: return "CUE";
+    case Journal::ACTION: return "ACTION";
+    default: return "?";
+    }
+}
+
+static std::string addressOf(uint32_t addr, uint16_t port)
+{
+    char ip[INET_ADDRSTRLEN] = {0};
+    in_addr a{};
+    a.s_addr = addr;
+    inet_ntop(AF_INET, &a, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(port);
+}
+
+static void warnTruncated(const std::string& path, size_t records)
+{
+    std::cerr << path << ": truncated after " << records << " complete records; the torn tail is skipped"
+              << std::endl;
+}
+
+static void dump(const std::string& path)
+{
+    SessionTimeline timeline;
+    size_t records = 0;
+    bool truncated = false;
+    bool ok = Journal::read(path, [&](const Journal::Record& rec, const char* payload)
+    {
+        records++;
+        int64_t at = timeline.place(rec);
+        printf("%12.3f %-7s local=%-5u %-21s %.*s\n", at / 1e6, typeName(rec.type),
+               rec.localPort, rec.addr ? addressOf(rec.addr, rec.port).c_str() : "-",
+               static_cast<int>(rec.length), payload);
+    }, &truncated);
+    if (!ok)
+        std::cerr << path << ": not a journal" << std::endl;
+    else if (truncated)
+        warnTruncated(path, records);
+}
+
+// Records of a type in a journal, to compare the recording with the replay.
+// OUT records only count when sent by the controller (from its listen port).
+static size_t countRecords(const std::string& path, uint8_t type, uint16_t controllerPort)
+{
+    size_t count = 0;
+    Journal::read(path, [&](const Journal::Record& rec, const char*)
+    {
+        if (rec.type == type && (type != Journal::OUT || rec.localPort == controllerPort))
+            count++;
+    });
+    return count;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " <journal> [--config player.json] [--speed 1] [--out replay.journal] [--dump]" << std::endl;
+        return 2;
+    }
+    std::string input = argv[1];
+    std::string configPath = CONFIG_PATH;
+    std::string output = "replay.journal";
+    double speed = 1.0;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--dump")
+        {
+            dump(input);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << arg << std::endl;
+            return 2;
+        }
+        if (arg == "--config")
+            configPath = argv[++i];
+        else if (arg == "--speed")
+            speed = std::atof(argv[++i]);
+        else if (arg == "--out")
+            output = argv[++i];
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    json config;
+    if (!readConfigFile(configPath, config))
+        return 1;
+
+    std::vector<Session> sessions;
+    SessionTimeline timeline;
+    int64_t firstSteadyNs = 0;
+    size_t records = 0;
+    bool truncated = false;
+    if (!Journal::read(input, [&](const Journal::Record& rec, const char* payload)
+    {
+        if (records++ == 0)
+            firstSteadyNs = rec.steadyNs;
+        size_t known = timeline.sessions;
+        int64_t at = timeline.place(rec);
+        if (timeline.sessions != known)
+        {
+            sessions.emplace_back();
+            sessions.back().startNs = at;
+        }
+        Session& session = sessions.back();
+        session.endNs = at;
+        if (rec.type == Journal::SESSION)
+        {
+            std::string text(payload, rec.length);
+            unsigned long long value;
+            if ((session.seeded = field(text, "seed", value)))
+                session.seed = static_cast<uint32_t>(value);
+            if ((session.hasWall = field(text, "wall", value)))
+                session.wall = static_cast<std::time_t>(value);
+        }
+        if (rec.type != Journal::IN)
+            return;
+        Inbound in{};
+        in.atNs = at;
+        in.localPort = rec.localPort;
+        in.src.sin_family = AF_INET;
+        in.src.sin_addr.s_addr = rec.addr;
+        in.src.sin_port = htons(rec.port);
+        in.msg.assign(payload, rec.length);
+        while (!in.msg.empty() && (in.msg.back() == '\n' || in.msg.back() == '\r'))
+            in.msg.pop_back();
+        session.inbound.push_back(std::move(in));
+    }, &truncated))
+    {
+        std::cerr << input << ": not a journal" << std::endl;
+        return 1;
+    }
+    if (truncated)
+        warnTruncated(input, records);
+    std::cout << "Replaying " << sessions.size() << " sessions at speed " << speed << std::endl;
+
+    // A fresh output journal, so the counts below cover this run only.
+    std::remove(output.c_str());
+    Journal journal;
+    if (!journal.open(output, 64 << 20))
+        return 1;
+    Journal::setActive(&journal);
+    journal.append(Journal::SESSION, "replay of " + input);
+    UdpComm::setDryRun(true);
+
+    // The controller runs on virtual time, the recorded time of the first
+    // session carried on across the rest: timers fire between messages at
+    // their recorded moments whatever the speed, which only paces the feed.
+    auto virtualAt = [&](int64_t atNs)
+    {
+        return TimerWheel::Clock::time_point(
+            std::chrono::duration_cast<TimerWheel::Clock::duration>(std::chrono::nanoseconds(firstSteadyNs + atNs)));
+    };
+    uint16_t port = 0;
+    size_t fed = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < sessions.size(); s++)
+    {
+        const Session& session = sessions[s];
+        TimerWheel::useVirtualTime(virtualAt(session.startNs), session.hasWall ? session.wall : TimerWheel::wallNow());
+
+        // Each session is a restart: fresh counters, generators and timers.
+        // Only what the controller received is replayed; its sends and cues
+        // are journaled to the output for comparison.
+        Controller controller;
+        if (session.seeded)
+            controller.random_seed = session.seed;
+        else
+            std::cerr << "session " << s + 1 << " has no recorded seed; its generators will differ" << std::endl;
+        controller.configure(config);
+        controller.startOffline();
+        port = static_cast<uint16_t>(controller.udp_listen_port);
+        for (const Inbound& in : session.inbound)
+        {
+            if (in.localPort != port)
+                continue;
+            if (speed > 0.0)
+                std::this_thread::sleep_until(started +
+                                              std::chrono::nanoseconds(static_cast<int64_t>(in.atNs / speed)));
+            controller.advanceTo(virtualAt(in.atNs));
+            controller.injectMessage(in.msg, in.src);
+            fed++;
+        }
+
+        // The run ended with its last record; the final one gets up to a
+        // minute more for its delayed actions.
+        auto until = virtualAt(session.endNs);
+        controller.advanceTo(until);
+        for (int i = 0; s + 1 == sessions.size() && i < 600 && controller.pendingTimers() > 0; i++)
+        {
+            until += std::chrono::milliseconds(100);
+            controller.advanceTo(until);
+        }
+        std::cout << controller.statsReport() << std::endl;
+    }
+    double feedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+    journal.close();
+    printf("fed %zu messages in %.1f ms (%.0f msg/s)\n", fed, feedMs, feedMs > 0 ? fed * 1000.0 / feedMs : 0.0);
+    printf("cues: recorded %zu, replayed %zu; controller sends: recorded %zu, replayed %zu\n",
+           countRecords(input, Journal::CUE, port), countRecords(output, Journal::CUE, port),
+           countRecords(input, Journal::OUT, port), countRecords(output, Journal::OUT, port));
+    return 0;
+}
@@ -0,0 +1,388 @@
+// Load simulator: runs N fake players on localhost ports against a controller
+// and measures its reaction latency, from a player's EOF to the PLAY the
+// controller sends back.
+//
+//   CharUDPSim [--players 10,100,1000] [--duration-s 20] [--clip-ms 2000-8000]
+//              [--chatter-hz 1] [--end-message EOF] [--fanout-hz 0] [--base-port 30000]
+//              [--controller-port 22346] [--external] [--write-config sim.json]
+//
+// By default a controller runs in this process with a generated config: one
+// device per player (addressed by port) and one cue per player answering its
+// end message with a PLAY. With --fanout-hz, SIM0 also sends FANOUT at that
+// rate and a cue answers it with a PING to the group of all players, timing
+// how long the controller takes to address every device. With --external the players talk to a controller
+// already running on --controller-port; --write-config saves the matching
+// config for it.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment (lib, "Ws2_32.lib")
+#define poll WSAPoll
+typedef int socklen_t;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Controller.h"
+#include "Histogram.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+struct Options
+{
+    std::vector<int> players = {10, 100, 1000};
+    int durationS = 20;
+    int clipMinMs = 2000;
+    int clipMaxMs = 8000;
+    double chatterHz = 1.0;
+    double fanoutHz = 0.0;
+    std::string endMessage = "EOF";
+    int basePort = 30000;
+    int controllerPort = 22346;
+    bool external = false;
+    std::string writeConfig;
+};
+
+struct SimPlayer
+{
+    int sock = -1;
+    uint16_t port = 0;
+    int64_t endSentNs = -1;  // When the last end message went out, -1 once answered.
+};
+
+struct Event
+{
+    int64_t atNs;
+    uint32_t player;
+    enum Kind { ClipEnd, Chatter, Fanout } kind;
+    bool operator>(const Event& other) const { return atNs > other.atNs; }
+};
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string deviceName(size_t i)
+{
+    return "SIM" + std::to_string(i);
+}
+
+static json simulatorConfig(const Options& options, int players)
+{
+    json config;
+    config["devices"] = json::object();
+    config["cues"] = json::array();
+    for (int i = 0; i < players; i++)
+    {
+        std::string name = deviceName(i);
+        config["devices"][name] = {{"ip", "127.0.0.1"}, {"port", options.basePort + i}};
+        config["cues"].push_back({
+            {"name", "next-" + name},
+            {"trigger", {{"type", "udp_message"}, {"message", options.endMessage}, {"from_device", name}}},
+            {"actions", json::array({{{"type", "send_udp"}, {"message", "PLAY clip.mp4"},
+                                      {"destination", json::array({name})}}})}});
+    }
+    config["groups"] = {{"sim", json::array({"SIM*"})}};
+    config["cues"].push_back({
+        {"name", "fanout"},
+        {"trigger", {{"type", "udp_message"}, {"message", "FANOUT"}, {"from_device", deviceName(0)}}},
+        {"actions", json::array({{{"type", "send_udp"}, {"message", "PING"},
+                                  {"destination", json::array({"sim"})}}})}});
+    config["startup"] = {{"timeout_ms", 5000}, {"probe_interval_ms", 250}};
+    return config;
+}
+
+static void closeSocket(int sock)
+{
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+static void runOnce(const Options& options, int count, int controllerPort)
+{
+    sockaddr_in controllerAddr{};
+    controllerAddr.sin_family = AF_INET;
+    controllerAddr.sin_port = htons(static_cast<uint16_t>(controllerPort));
+    controllerAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<SimPlayer> players(count);
+    std::vector<pollfd> fds(count);
+    for (int i = 0; i < count; i++)
+    {
+        SimPlayer& p = players[i];
+        p.port = static_cast<uint16_t>(options.basePort + i);
+        p.sock = static_cast<int>(socket(AF_INET, SOCK_DGRAM, 0));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(p.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (p.sock < 0 || bind(p.sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        {
+            std::cerr << "cannot bind simulated player to port " << p.port << ": " << strerror(errno) << std::endl;
+            for (int j = 0; j <= i; j++)
+                if (players[j].sock >= 0)
+                    closeSocket(players[j].sock);
+            return;
+        }
+        fds[i].fd = p.sock;
+        fds[i].events = POLLIN;
+    }
+
+    auto send = [&](const SimPlayer& p, const std::string& msg)
+    {
+        sendto(p.sock, msg.c_str(), static_cast<int>(msg.size()), 0,
+               reinterpret_cast<const sockaddr*>(&controllerAddr), sizeof(controllerAddr));
+    };
+
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> clipMs(options.clipMinMs, std::max(options.clipMinMs, options.clipMaxMs));
+    std::uniform_real_distribution<double> phase(0.0, 1.0);
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    int64_t start = nowNs();
+    int64_t chatterNs = options.chatterHz > 0 ? static_cast<int64_t>(1e9 / options.chatterHz) : 0;
+    for (int i = 0; i < count; i++)
+    {
+        send(players[i], "READY");
+        events.push({start + clipMs(gen) * 1000000LL, static_cast<uint32_t>(i), Event::ClipEnd});
+        if (chatterNs)
+            events.push({start + static_cast<int64_t>(phase(gen) * chatterNs), static_cast<uint32_t>(i),
+                          Event::Chatter});
+    }
+    // The first fan-out waits for the controller's startup.
+    int64_t fanoutNs = options.fanoutHz > 0 ? static_cast<int64_t>(1e9 / options.fanoutHz) : 0;
+    if (fanoutNs)
+        events.push({start + 1000000000LL, 0, Event::Fanout});
+
+    std::unique_ptr<Controller> controller;
+    if (!options.external)
+    {
+        controller = std::make_unique<Controller>();
+        controller->udp_listen_port = controllerPort;
+        controller->configure(simulatorConfig(options, count));
+        std::thread(&Controller::start, controller.get()).detach();
+    }
+
+    Histogram latency;
+    // Fan-out: per PING from FANOUT to its arrival, and per round from FANOUT
+    // to the last player receiving it.
+    Histogram fanoutArrival, fanoutComplete;
+    int64_t fanoutSentNs = -1;
+    int fanoutPending = 0;
+    uint64_t fanoutRounds = 0;
+    uint64_t endsSent = 0, replies = 0, received = 0, chatter = 0;
+    int64_t end = start + options.durationS * 1000000000LL;
+    char buffer[2048];
+    while (nowNs() < end)
+    {
+        // Due events first: clip ends and log chatter.
+        int64_t now = nowNs();
+        while (!events.empty() && events.top().atNs <= now)
+        {
+            Event e = events.top();
+            events.pop();
+            SimPlayer& p = players[e.player];
+            if (e.kind == Event::Chatter)
+            {
+                send(p, "STATE {\"pos\":" + std::to_string((now - start) / 1000000000.0) + "}");
+                chatter++;
+                events.push({e.atNs + chatterNs, e.player, Event::Chatter});
+            }
+            else if (e.kind == Event::Fanout)
+            {
+                // A round still missing PINGs is counted as incomplete.
+                send(p, "FANOUT");
+                fanoutSentNs = nowNs();
+                fanoutPending = count;
+                fanoutRounds++;
+                events.push({e.atNs + fanoutNs, e.player, Event::Fanout});
+            }
+            else
+            {
+                send(p, options.endMessage);
+                p.endSentNs = nowNs();
+                endsSent++;
+            }
+        }
+
+        int64_t waitNs = events.empty() ? 50000000 : std::max<int64_t>(0, events.top().atNs - nowNs());
+        int ready = poll(fds.data(), static_cast<unsigned long>(fds.size()),
+                         static_cast<int>(std::min<int64_t>(waitNs / 1000000, 50)));
+        if (ready <= 0)
+            continue;
+        for (int i = 0; i < count; i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            SimPlayer& p = players[i];
+            int bytes = static_cast<int>(recv(p.sock, buffer, sizeof(buffer) - 1, 0));
+            if (bytes <= 0)
+                continue;
+            buffer[bytes] = '\0';
+            received++;
+            std::string msg(buffer);
+            if (msg == "STATUS")
+            {
+                send(p, "STATUS {\"v\":1,\"name\":\"" + deviceName(i) + "\"}");
+            }
+            else if (msg == "PING")
+            {
+                if (fanoutSentNs >= 0)
+                {
+                    double ms = (nowNs() - fanoutSentNs) / 1e6;
+                    fanoutArrival.record(ms);
+                    if (--fanoutPending == 0)
+                        fanoutComplete.record(ms);
+                }
+            }
+            else if (msg.rfind("PLAY ", 0) == 0 || msg.rfind("LOAD ", 0) == 0)
+            {
+                int64_t t = nowNs();
+                if (p.endSentNs >= 0)
+                {
+                    latency.record((t - p.endSentNs) / 1e6);
+                    p.endSentNs = -1;
+                    replies++;
+                }
+                send(p, "Loaded file: " + msg.substr(5));
+                events.push({t + clipMs(gen) * 1000000LL, static_cast<uint32_t>(i), Event::ClipEnd});
+            }
+        }
+    }
+
+    uint64_t unanswered = 0;
+    for (auto& p : players)
+    {
+        if (p.endSentNs >= 0)
+            unanswered++;
+        closeSocket(p.sock);
+    }
+    printf("players=%d ends=%llu replies=%llu unanswered=%llu chatter=%llu received=%llu latency %s\n", count,
+           static_cast<unsigned long long>(endsSent), static_cast<unsigned long long>(replies),
+           static_cast<unsigned long long>(unanswered), static_cast<unsigned long long>(chatter),
+           static_cast<unsigned long long>(received), latency.summary().c_str());
+    if (fanoutRounds)
+        printf("  fanout rounds=%llu complete=%llu arrival %s\n  fanout last_arrival %s\n",
+               static_cast<unsigned long long>(fanoutRounds),
+               static_cast<unsigned long long>(fanoutComplete.count()), fanoutArrival.summary().c_str(),
+               fanoutComplete.summary().c_str());
+    if (controller)
+    {
+        printf("  controller %s\n", controller->statsReport().c_str());
+        // The controller's listener thread never returns; leave it running.
+        controller.release();
+    }
+    fflush(stdout);
+}
+
+static bool parseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--external")
+        {
+            options.external = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--players")
+        {
+            options.players.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ','))
+                options.players.push_back(std::atoi(item.c_str()));
+        }
+        else if (arg == "--duration-s")
+            options.durationS = std::atoi(value.c_str());
+        else if (arg == "--clip-ms")
+        {
+            options.clipMinMs = std::atoi(value.c_str());
+            size_t dash = value.find('-');
+            options.clipMaxMs = dash == std::string::npos ? options.clipMinMs : std::atoi(value.c_str() + dash + 1);
+        }
+        else if (arg == "--chatter-hz")
+            options.chatterHz = std::atof(value.c_str());
+        else if (arg == "--fanout-hz")
+            options.fanoutHz = std::atof(value.c_str());
+        else if (arg == "--end-message")
+            options.endMessage = value;
+        else if (arg == "--base-port")
+            options.basePort = std::atoi(value.c_str());
+        else if (arg == "--controller-port")
+            options.controllerPort = std::atoi(value.c_str());
+        else if (arg == "--write-config")
+            options.writeConfig = value;
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return !options.players.empty();
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#else
+    // Thousands of players need thousands of sockets.
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+
+    int largest = *std::max_element(options.players.begin(), options.players.end());
+    if (!options.writeConfig.empty())
+    {
+        std::ofstream out(options.writeConfig);
+        json config = simulatorConfig(options, largest);
+        config["is_controller"] = true;
+        out << config.dump(2) << std::endl;
+        std::cout << "Wrote controller config for " << largest << " players to " << options.writeConfig << std::endl;
+    }
+
+    // Each in-process run gets its own controller port; earlier controllers stay bound.
+    for (size_t run = 0; run < options.players.size(); run++)
+        runOnce(options, options.players[run],
+                options.controllerPort + (options.external ? 0 : static_cast<int>(run)));
+    std::_Exit(0);
+}
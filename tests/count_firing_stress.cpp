@@ -0,0 +1,66 @@
+// Fires the same cues from many threads at once and checks that
+// CueTable::countFiring hands out exactly one alternate per count firings:
+// no two threads may share a count and none may be skipped.
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "CueTable.h"
+
+static json cueWithCount(const std::string &name, int count)
+{
+    json action = {{"type", "send_udp"}, {"message", name}, {"destination", json::array({"P1"})}};
+    return {{"name", name},
+            {"trigger", {{"type", "udp_message"}, {"message", name}, {"from_device", "*"}, {"count", count}}},
+            {"actions", json::array({action})},
+            {"alternate_actions", json::array({action})}};
+}
+
+int main()
+{
+    const int counts[] = {1, 2, 3, 7, 64};
+    json config = {{"devices", {{"P1", {{"ip", "127.0.0.1"}}}}}, {"cues", json::array()}};
+    for (int count : counts)
+        config["cues"].push_back(cueWithCount("c" + std::to_string(count), count));
+    auto table = CueTable::build(config, 12345);
+
+    const int threads = 8;
+    const int firingsPerThread = 200000;
+    const size_t cueCount = sizeof(counts) / sizeof(counts[0]);
+    std::vector<std::atomic<uint64_t>> alternates(cueCount);
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+        {
+            std::vector<uint64_t> mine(cueCount, 0);
+            while (!go)
+                std::this_thread::yield();
+            for (int i = 0; i < firingsPerThread; i++)
+                for (uint32_t cue = 0; cue < cueCount; cue++)
+                    if (table->countFiring(cue))
+                        mine[cue]++;
+            for (size_t cue = 0; cue < cueCount; cue++)
+                alternates[cue] += mine[cue];
+        });
+    }
+    go = true;
+    for (auto &w : workers)
+        w.join();
+
+    const uint64_t total = static_cast<uint64_t>(threads) * firingsPerThread;
+    int failures = 0;
+    for (size_t cue = 0; cue < cueCount; cue++)
+    {
+        uint64_t expected = total / counts[cue];
+        bool ok = alternates[cue] == expected;
+        printf("count=%d firings=%llu alternates=%llu expected=%llu %s\n", counts[cue],
+               static_cast<unsigned long long>(total), static_cast<unsigned long long>(alternates[cue].load()),
+               static_cast<unsigned long long>(expected), ok ? "ok" : "FAIL");
+        if (!ok)
+            failures++;
+    }
+    return failures ? 1 : 0;
+}